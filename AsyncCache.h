@@ -12,6 +12,7 @@
 #include "LruClockCache.h"
 #include "integer_key_specialization/DirectMappedCache.h"
 #include "integer_key_specialization/DirectMappedCacheShard.h"
+#include "LockProfiler.h"
 #include <vector>
 #include <mutex>
 #include<thread>
@@ -293,6 +294,19 @@ public:
 		}
 	}
 
+	// starts recording statistics of producer-slot locks (acquisitions, contention, wait/hold time histograms)
+	// lock i is shared by the consumer thread and producers of slot i, so waits show which slots collide
+	void enableLockProfiler()
+	{
+		locks.profiler.enable(numProducers);
+	}
+
+	// lock statistics per producer slot, example: cache.getLockProfiler().report(std::cout,8,"slot");
+	const LockProfiler & getLockProfiler() const
+	{
+		return locks.profiler;
+	}
+
 	~AsyncCache()
 	{
 		barrier();
@@ -383,15 +397,38 @@ private:
 	    FastMutex(int n):flag(n){}
 	    void lock(int i)
 	    {
+	        if(profiler.isEnabled())
+	        {
+	            lockProfiled(i);
+	            return;
+	        }
 	        while (flag[i].flag.exchange(true, std::memory_order_relaxed));
 	        std::atomic_thread_fence(std::memory_order_acquire);
 	    }
 
 	    void unlock(int i)
 	    {
+	        if(profiler.isEnabled())
+	            profiler.releasing(i);
 	        std::atomic_thread_fence(std::memory_order_release);
 	        flag[i].flag.store(false, std::memory_order_relaxed);
 	    }
+
+	    LockProfiler profiler;
+	private:
+	    void lockProfiled(int i)
+	    {
+	        if(!flag[i].flag.exchange(true, std::memory_order_relaxed))
+	        {
+	            std::atomic_thread_fence(std::memory_order_acquire);
+	            profiler.acquired(i,0,false);
+	            return;
+	        }
+	        const uint64_t start = LockProfiler::now();
+	        while (flag[i].flag.exchange(true, std::memory_order_relaxed));
+	        std::atomic_thread_fence(std::memory_order_acquire);
+	        profiler.acquired(i,LockProfiler::now()-start,true);
+	    }
 	};
 
 	//std::vector<MutexWithoutFalseSharing> locks;
@@ -0,0 +1,269 @@
+/*
+ * CacheHierarchy.h
+ *
+ *  Created on: Nov 14, 2021
+ *      Author: tugrul
+ */
+
+#ifndef CACHEHIERARCHY_H_
+#define CACHEHIERARCHY_H_
+
+#include<tuple>
+#include<memory>
+#include<functional>
+#include<utility>
+#include<type_traits>
+#include"integer_key_specialization/StripedLockTable.h"
+#include"integer_key_specialization/KeyMixer.h"
+#include"CacheWritePolicy.h"
+
+// selects write policy of a level (see CacheWritePolicy.h): CacheHierarchy<CacheLevel<DirectMappedCache<int,int>,CacheWritePolicy::WRITE_THROUGH>, ...>
+// a level given without CacheLevel is WRITE_BACK, WRITE_AROUND is given to the level with its enableWritePolicy()
+template<typename Cache, CacheWritePolicy Policy = CacheWritePolicy::WRITE_BACK>
+struct CacheLevel
+{
+
+};
+
+template<typename Level>
+struct CacheLevelTraits
+{
+	using Cache = Level;
+	static constexpr CacheWritePolicy writePolicy = CacheWritePolicy::WRITE_BACK;
+};
+
+template<typename LevelCache, CacheWritePolicy Policy>
+struct CacheLevelTraits<CacheLevel<LevelCache,Policy>>
+{
+	using Cache = LevelCache;
+	static constexpr CacheWritePolicy writePolicy = Policy;
+};
+
+// key and value types of a cache class (first two template parameters)
+template<typename Cache>
+struct CacheKeyValueTypes;
+
+template<template<typename,typename,typename...> class Cache, typename CacheKey, typename CacheValue, typename ... Rest>
+struct CacheKeyValueTypes<Cache<CacheKey,CacheValue,Rest...>>
+{
+	using Key = CacheKey;
+	using Value = CacheValue;
+};
+
+/* multi-level cache composed at compile-time: CacheHierarchy<Level1, Level2, ..., BackingStore>
+ * Level: any cache with accessWith/accessThreadSafeWith methods (DirectMappedCache, DirectMappedMultiThreadCache, LruClockCache, NWaySetAssociativeMultiThreadCache)
+ * 			or CacheLevel<cache, write policy>
+ * 			all levels have same key and value types
+ * BackingStore: class with
+ * 			CacheValue read(const CacheKey & key) and
+ * 			void write(const CacheKey & key, const CacheValue & value)
+ * 			(called from multiple threads if thread-safe methods are used)
+ * a miss of level i calls level i+1 through a lambda (not std::function), so whole chain of a get/set is inlined into one function
+ * levels are also constructed with std::function callbacks to next level, these are only used by flush() and rebalance() of a level
+ * set of a write-through level writes next level first and then the level (a concurrent reload of the key from next level can not bring back the old value)
+ * 			thread-safe set also locks a stripe of key (see StripedLockTable.h) so that concurrent writers of same key update both levels in same order
+ * 			see sample_coherency/hierarchy_write_through.cpp
+ * 2D/3D/ND caches are not usable as levels (their misses load whole tiles of multi-dimensional keys)
+ *
+ * example: 	L1 = direct-mapped write-through, L2 = N-way set-associative write-back, then a database
+ * 		CacheHierarchy<CacheLevel<DirectMappedMultiThreadCache<int,int>,CacheWritePolicy::WRITE_THROUGH>,NWaySetAssociativeMultiThreadCache<int,int>,Database> cache(db,1024*64,std::make_tuple(256,1024));
+ */
+template<typename ... LevelsAndBackingStore>
+class CacheHierarchy
+{
+	static constexpr size_t numLevels = sizeof...(LevelsAndBackingStore) - 1;
+	static_assert(sizeof...(LevelsAndBackingStore) >= 2, "CacheHierarchy needs at least 1 cache level and a backing-store");
+
+	template<size_t I>
+	using Traits = CacheLevelTraits<std::tuple_element_t<I,std::tuple<LevelsAndBackingStore...>>>;
+
+	template<size_t I>
+	using Level = typename Traits<I>::Cache;
+
+	using BackingStore = std::tuple_element_t<numLevels,std::tuple<LevelsAndBackingStore...>>;
+	using CacheKey = typename CacheKeyValueTypes<Level<0>>::Key;
+	using CacheValue = typename CacheKeyValueTypes<Level<0>>::Value;
+
+	template<typename Sequence>
+	struct LevelPointers;
+
+	template<size_t ... I>
+	struct LevelPointers<std::index_sequence<I...>>
+	{
+		using Type = std::tuple<std::unique_ptr<Level<I>>...>;
+	};
+public:
+	// backingStore: last level, has to live longer than the hierarchy
+	// levelSizes: constructor arguments (that are before readMiss/writeMiss) of each level
+	// 				an integer for a single argument (number of tags of a direct-mapped/LRU cache)
+	//				or a std::tuple for multiple arguments (number of sets and tags per set of an N-way cache)
+	template<typename ... LevelSizes>
+	CacheHierarchy(BackingStore & backingStore, const LevelSizes & ... levelSizes):
+		store(backingStore),
+		levels(createLevels(std::make_index_sequence<numLevels>(),std::forward_as_tuple(levelSizes...)))
+	{
+		static_assert(sizeof...(LevelSizes) == numLevels, "CacheHierarchy needs constructor arguments for each level");
+		for(size_t i=0;i<numLevels;i++)
+			writeLocks[i] = StripedLockTable(writeThrough(i)?StripedLockTable::defaultMaxStripes:0);
+	}
+
+	inline
+	CacheValue get(const CacheKey & key) noexcept
+	{
+		return access<0,false>(key,nullptr,0);
+	}
+
+	inline
+	void set(const CacheKey & key, const CacheValue & value) noexcept
+	{
+		access<0,false>(key,&value,1);
+	}
+
+	// thread-safe versions use thread-safe accesses of all levels
+	inline
+	CacheValue getThreadSafe(const CacheKey & key) noexcept
+	{
+		return access<0,true>(key,nullptr,0);
+	}
+
+	inline
+	void setThreadSafe(const CacheKey & key, const CacheValue & value) noexcept
+	{
+		access<0,true>(key,&value,1);
+	}
+
+	// level I of hierarchy, to use its own methods (enableLockProfiler(), capacities(), ...)
+	// get/set of a level bypasses levels above it
+	template<size_t I>
+	Level<I> & level()
+	{
+		return *std::get<I>(levels);
+	}
+
+	// writes edited items of each level to next level, starting from first level so that last level writes everything to backing-store
+	// call before shutting program/connection down and after all read/write of other threads are complete
+	// parallelism: passed to levels that have flush(int) (1 = calling thread only, 0 = std::thread::hardware_concurrency())
+	void flush(const int parallelism = 1)
+	{
+		flushLevels(std::make_index_sequence<numLevels>(),parallelism);
+	}
+private:
+	static constexpr bool writeThrough(const size_t index) noexcept
+	{
+		constexpr CacheWritePolicy policies[] = { CacheLevelTraits<LevelsAndBackingStore>::writePolicy... };
+		return policies[index] == CacheWritePolicy::WRITE_THROUGH;
+	}
+
+	// get/set on level I, level numLevels is backing-store
+	template<size_t I, bool threadSafe>
+	inline
+	CacheValue access(const CacheKey & key, const CacheValue * value, const bool opType)
+	{
+		if constexpr (I == numLevels)
+		{
+			if(opType == 0)
+				return store.read(key);
+			store.write(key,*value);
+			return *value;
+		}
+		else
+		{
+			const auto load = [this](const CacheKey & missKey){ return this->template access<I+1,threadSafe>(missKey,nullptr,0); };
+			if constexpr (Traits<I>::writePolicy == CacheWritePolicy::WRITE_THROUGH)
+			{
+				const auto noSave = [](const CacheKey &, const CacheValue &){ };
+				if(opType == 0)
+					return accessLevel<I,threadSafe>(key,nullptr,0,load,noSave);
+
+				// next level is written first: a reader that misses this level in between reloads the new value
+				// (writing this level first would let such a reload put the old value back after the write)
+				// stripe of key keeps concurrent writers of key in same order on both levels
+				if constexpr (threadSafe)
+				{
+					StripedLockTable::Guard lg(writeLocks[I],hasher(key));
+					access<I+1,threadSafe>(key,value,1);
+					accessLevel<I,threadSafe>(key,value,1,load,noSave);
+				}
+				else
+				{
+					access<I+1,threadSafe>(key,value,1);
+					accessLevel<I,threadSafe>(key,value,1,load,noSave);
+				}
+				return *value;
+			}
+			else
+			{
+				const auto save = [this](const CacheKey & evictedKey, const CacheValue & evictedValue){ this->template access<I+1,threadSafe>(evictedKey,&evictedValue,1); };
+				return accessLevel<I,threadSafe>(key,value,opType,load,save);
+			}
+		}
+	}
+
+	template<size_t I, bool threadSafe, typename Load, typename Save>
+	inline
+	CacheValue accessLevel(const CacheKey & key, const CacheValue * value, const bool opType, const Load & load, const Save & save)
+	{
+		if constexpr (threadSafe)
+			return level<I>().accessThreadSafeWith(key,value,opType,load,save);
+		else
+			return level<I>().accessWith(key,value,opType,load,save);
+	}
+
+	template<size_t ... I, typename Sizes>
+	typename LevelPointers<std::index_sequence<I...>>::Type createLevels(std::index_sequence<I...>, const Sizes & sizes)
+	{
+		return typename LevelPointers<std::index_sequence<I...>>::Type(createLevel<I>(std::get<I>(sizes))...);
+	}
+
+	template<size_t I, typename Size>
+	std::unique_ptr<Level<I>> createLevel(const Size & size)
+	{
+		// cold path (flush, rebalance) of level, thread-safe because flush of a level can be parallel
+		const std::function<CacheValue(CacheKey)> readMiss = [this](CacheKey key){ return this->template access<I+1,true>(key,nullptr,0); };
+		const std::function<void(CacheKey,CacheValue)> writeMiss = [this](CacheKey key, CacheValue value){
+			if constexpr (Traits<I>::writePolicy != CacheWritePolicy::WRITE_THROUGH)
+				this->template access<I+1,true>(key,&value,1);
+		};
+		std::unique_ptr<Level<I>> result = std::apply([&](const auto & ... args){ return std::make_unique<Level<I>>(args...,readMiss,writeMiss); },sizeArguments(size));
+
+		// write-around misses are written to next level by save lambda of access()
+		if constexpr (Traits<I>::writePolicy == CacheWritePolicy::WRITE_AROUND)
+			result->enableWritePolicy(CacheWritePolicy::WRITE_AROUND);
+		return result;
+	}
+
+	template<typename Size>
+	static auto sizeArguments(const Size & size)
+	{
+		if constexpr (std::is_integral<Size>::value)
+			return std::make_tuple(size);
+		else
+			return size;
+	}
+
+	template<size_t ... I>
+	void flushLevels(std::index_sequence<I...>, const int parallelism)
+	{
+		(flushLevel(level<I>(),parallelism,0),...);
+	}
+
+	template<typename Cache>
+	static auto flushLevel(Cache & cache, const int parallelism, int) -> decltype(cache.flush(parallelism),void())
+	{
+		cache.flush(parallelism);
+	}
+
+	template<typename Cache>
+	static void flushLevel(Cache & cache, const int, long)
+	{
+		cache.flush();
+	}
+
+	BackingStore & store;
+	typename LevelPointers<std::make_index_sequence<numLevels>>::Type levels;
+	StripedLockTable writeLocks[numLevels];
+	IntegerKeyMixer<CacheKey> hasher;
+};
+
+
+#endif /* CACHEHIERARCHY_H_ */
@@ -0,0 +1,25 @@
+/*
+ * CacheWritePolicy.h
+ *
+ *  Created on: Nov 20, 2021
+ *      Author: tugrul
+ */
+
+#ifndef CACHEWRITEPOLICY_H_
+#define CACHEWRITEPOLICY_H_
+
+// how a cache (or a level of CacheHierarchy) handles "set"
+// WRITE_BACK: 		value stays in cache until it is evicted or flushed, then it is written to next level (backing-store) (default)
+// WRITE_THROUGH: 	value is written to cache and to next level in same call, evicted/flushed items are not written again
+//					(next level is always current, flush is not needed)
+// WRITE_AROUND: 	no-write-allocate, set of a key that is not in cache writes next level directly without evicting anything
+//					set of a key that is in cache updates it as WRITE_BACK (bulk writes/imports do not replace the items that are read)
+enum class CacheWritePolicy
+{
+	WRITE_BACK,
+	WRITE_THROUGH,
+	WRITE_AROUND
+};
+
+
+#endif /* CACHEWRITEPOLICY_H_ */
@@ -0,0 +1,280 @@
+/*
+ * LockProfiler.h
+ *
+ *  Created on: Nov 13, 2021
+ *      Author: tugrul
+ */
+
+#ifndef LOCKPROFILER_H_
+#define LOCKPROFILER_H_
+
+#include<vector>
+#include<array>
+#include<atomic>
+#include<memory>
+#include<chrono>
+#include<cstdint>
+#include<algorithm>
+#include<iostream>
+
+/* optional statistics of a group of locks (1 mutex of LruClockCache, stripes of a striped lock table, sets of N-way cache, ...)
+ * per lock index: number of acquisitions, number of contended acquisitions (lock was already taken)
+ * 		wait time (from start of lock() to acquisition) and hold time (from acquisition to unlock()) in nanoseconds
+ * 		log2 histograms of wait and hold times (bucket k = [2^(k-1), 2^k) nanoseconds, bucket 0 = 0 ns)
+ * disabled by default: a disabled profiler costs 1 branch per lock/unlock
+ * enable() can be called any time (also while other threads use the locks), there is no disable (reset() clears statistics)
+ * statistics of a lock are written only by the thread holding that lock, so profiling adds no shared counters between locks
+ * 		statistics() and report() can be called any time, values read during heavy traffic may be a few acquisitions behind
+ */
+class LockProfiler
+{
+public:
+	static constexpr int numBuckets = 32;
+
+	struct Statistics
+	{
+		size_t index;
+		uint64_t acquisitions;
+		uint64_t contended;
+		uint64_t waitNanoseconds;
+		uint64_t holdNanoseconds;
+		std::array<uint64_t,numBuckets> waitHistogram;
+		std::array<uint64_t,numBuckets> holdHistogram;
+	};
+
+	LockProfiler():numLocks(0),enabled(false)
+	{
+
+	}
+
+	// numberOfLocks: number of lock indices (lock index has to be less than this)
+	void enable(const size_t numberOfLocks)
+	{
+		if(enabled.load(std::memory_order_acquire))
+			return;
+		numLocks = numberOfLocks;
+		stats = std::unique_ptr<LockStatistics[]>(new LockStatistics[numLocks]);
+		enabled.store(true,std::memory_order_release);
+	}
+
+	inline
+	bool isEnabled() const noexcept
+	{
+		return enabled.load(std::memory_order_acquire);
+	}
+
+	// locks mut and records statistics under lock index
+	template<typename Mutex>
+	inline
+	void lock(Mutex & mut, const size_t index)
+	{
+		if(!isEnabled())
+		{
+			mut.lock();
+			return;
+		}
+
+		if(mut.try_lock())
+		{
+			acquired(index,0,false);
+			return;
+		}
+		const uint64_t start = now();
+		mut.lock();
+		acquired(index,now()-start,true);
+	}
+
+	template<typename Mutex>
+	inline
+	void unlock(Mutex & mut, const size_t index)
+	{
+		if(isEnabled())
+			releasing(index);
+		mut.unlock();
+	}
+
+	// for locks without try_lock()/lock(): call after acquiring (while holding the lock)
+	inline
+	void acquired(const size_t index, const uint64_t waitNanoseconds, const bool contended) noexcept
+	{
+		LockStatistics & s = stats[index];
+		bump(s.acquisitions,1);
+		if(contended)
+			bump(s.contended,1);
+		bump(s.waitNanoseconds,waitNanoseconds);
+		bump(s.waitHistogram[bucketOf(waitNanoseconds)],1);
+		s.lastAcquire = now();
+	}
+
+	// for locks without try_lock()/lock(): call before releasing (while holding the lock)
+	inline
+	void releasing(const size_t index) noexcept
+	{
+		LockStatistics & s = stats[index];
+		// lock may have been acquired before enable()
+		if(s.lastAcquire == 0)
+			return;
+		const uint64_t hold = now() - s.lastAcquire;
+		s.lastAcquire = 0;
+		bump(s.holdNanoseconds,hold);
+		bump(s.holdHistogram[bucketOf(hold)],1);
+	}
+
+	// statistics of locks that were acquired at least once, ordered by index
+	std::vector<Statistics> statistics() const
+	{
+		std::vector<Statistics> result;
+		if(!isEnabled())
+			return result;
+		for(size_t i=0;i<numLocks;i++)
+		{
+			const LockStatistics & s = stats[i];
+			Statistics r;
+			r.index = i;
+			r.acquisitions = s.acquisitions.load(std::memory_order_relaxed);
+			if(r.acquisitions == 0)
+				continue;
+			r.contended = s.contended.load(std::memory_order_relaxed);
+			r.waitNanoseconds = s.waitNanoseconds.load(std::memory_order_relaxed);
+			r.holdNanoseconds = s.holdNanoseconds.load(std::memory_order_relaxed);
+			for(int j=0;j<numBuckets;j++)
+			{
+				r.waitHistogram[j] = s.waitHistogram[j].load(std::memory_order_relaxed);
+				r.holdHistogram[j] = s.holdHistogram[j].load(std::memory_order_relaxed);
+			}
+			result.push_back(r);
+		}
+		return result;
+	}
+
+	// prints totals and the maxLocks locks with highest total wait time
+	// lockName: name of a lock index in output ("set", "stripe", ...)
+	void report(std::ostream & out, const size_t maxLocks = 8, const char * lockName = "lock") const
+	{
+		std::vector<Statistics> all = statistics();
+		Statistics total{};
+		for(const auto & s:all)
+		{
+			total.acquisitions += s.acquisitions;
+			total.contended += s.contended;
+			total.waitNanoseconds += s.waitNanoseconds;
+			total.holdNanoseconds += s.holdNanoseconds;
+			for(int j=0;j<numBuckets;j++)
+			{
+				total.waitHistogram[j] += s.waitHistogram[j];
+				total.holdHistogram[j] += s.holdHistogram[j];
+			}
+		}
+		out<<"all "<<lockName<<"s ("<<all.size()<<" used): ";
+		print(out,total);
+
+		std::sort(all.begin(),all.end(),[](const Statistics & a, const Statistics & b){ return a.waitNanoseconds > b.waitNanoseconds; });
+		for(size_t i=0;i<all.size() && i<maxLocks;i++)
+		{
+			out<<lockName<<" "<<all[i].index<<": ";
+			print(out,all[i]);
+		}
+	}
+
+	// sets all statistics to zero (not thread-safe against lock traffic)
+	void reset()
+	{
+		if(!isEnabled())
+			return;
+		stats = std::unique_ptr<LockStatistics[]>(new LockStatistics[numLocks]);
+	}
+
+	static inline
+	uint64_t now() noexcept
+	{
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+private:
+	struct alignas(64) LockStatistics
+	{
+		LockStatistics():acquisitions(0),contended(0),waitNanoseconds(0),holdNanoseconds(0),lastAcquire(0)
+		{
+			for(int j=0;j<numBuckets;j++)
+			{
+				waitHistogram[j].store(0,std::memory_order_relaxed);
+				holdHistogram[j].store(0,std::memory_order_relaxed);
+			}
+		}
+		std::atomic<uint64_t> acquisitions;
+		std::atomic<uint64_t> contended;
+		std::atomic<uint64_t> waitNanoseconds;
+		std::atomic<uint64_t> holdNanoseconds;
+		uint64_t lastAcquire;
+		std::atomic<uint64_t> waitHistogram[numBuckets];
+		std::atomic<uint64_t> holdHistogram[numBuckets];
+	};
+
+	// only lock holder writes, so a non-atomic read-modify-write is enough (atomic only for readers of statistics)
+	static inline
+	void bump(std::atomic<uint64_t> & counter, const uint64_t amount) noexcept
+	{
+		counter.store(counter.load(std::memory_order_relaxed)+amount,std::memory_order_relaxed);
+	}
+
+	static inline
+	int bucketOf(uint64_t nanoseconds) noexcept
+	{
+		int bucket = 0;
+		while(nanoseconds>0 && bucket<numBuckets-1)
+		{
+			nanoseconds >>= 1;
+			bucket++;
+		}
+		return bucket;
+	}
+
+	static void print(std::ostream & out, const Statistics & s)
+	{
+		const double n = s.acquisitions>0 ? (double)s.acquisitions : 1.0;
+		out<<"acquisitions="<<s.acquisitions<<" contended="<<s.contended<<" ("<<(100.0*s.contended/n)<<"%)"
+				<<" wait avg="<<(s.waitNanoseconds/n)<<"ns hold avg="<<(s.holdNanoseconds/n)<<"ns"<<std::endl;
+		printHistogram(out,"    wait",s.waitHistogram);
+		printHistogram(out,"    hold",s.holdHistogram);
+	}
+
+	static void printHistogram(std::ostream & out, const char * name, const std::array<uint64_t,numBuckets> & histogram)
+	{
+		out<<name<<" ns:";
+		for(int j=0;j<numBuckets;j++)
+		{
+			if(histogram[j]>0)
+				out<<" <"<<((uint64_t)1<<j)<<":"<<histogram[j];
+		}
+		out<<std::endl;
+	}
+
+	size_t numLocks;
+	std::atomic<bool> enabled;
+	std::unique_ptr<LockStatistics[]> stats;
+};
+
+// lock_guard that records statistics of lock index in a LockProfiler
+template<typename Mutex>
+class ProfiledLockGuard
+{
+public:
+	ProfiledLockGuard(Mutex & mutex, LockProfiler & lockProfiler, const size_t lockIndex):mut(mutex),profiler(lockProfiler),index(lockIndex)
+	{
+		profiler.lock(mut,index);
+	}
+
+	~ProfiledLockGuard()
+	{
+		profiler.unlock(mut,index);
+	}
+
+	ProfiledLockGuard(const ProfiledLockGuard &) = delete;
+	ProfiledLockGuard & operator=(const ProfiledLockGuard &) = delete;
+private:
+	Mutex & mut;
+	LockProfiler & profiler;
+	const size_t index;
+};
+
+
+#endif /* LOCKPROFILER_H_ */
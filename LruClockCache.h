@@ -14,6 +14,8 @@
 #include<functional>
 #include<mutex>
 #include<unordered_map>
+#include"LockProfiler.h"
+#include"CacheWritePolicy.h"
 
 
 /* LRU-CLOCK-second-chance implementation
@@ -37,7 +39,7 @@ public:
 	//				takes a LruKey as key and LruValue as value
 	LruClockCache(ClockHandInteger numElements,
 				const std::function<LruValue(LruKey)> & readMiss,
-				const std::function<void(LruKey,LruValue)> & writeMiss):size(numElements),loadData(readMiss),saveData(writeMiss)
+				const std::function<void(LruKey,LruValue)> & writeMiss):size(numElements),loadData(readMiss),saveData(writeMiss),writePolicy(CacheWritePolicy::WRITE_BACK)
 	{
 		ctr = 0;
 		// 50% phase difference between eviction and second-chance hands of the "second-chance" CLOCK algorithm
@@ -89,7 +91,7 @@ public:
 	inline
 	const LruValue getThreadSafe(const LruKey & key) noexcept
 	{
-		std::lock_guard<std::mutex> lg(mut);
+		ProfiledLockGuard<std::mutex> lg(mut,profiler,0);
 		return accessClock2Hand(key,nullptr);
 	}
 
@@ -111,14 +113,14 @@ public:
 	inline
 	void setThreadSafe(const LruKey & key, const LruValue & val)  noexcept
 	{
-		std::lock_guard<std::mutex> lg(mut);
+		ProfiledLockGuard<std::mutex> lg(mut,profiler,0);
 		accessClock2Hand(key,&val,1);
 	}
 
 	// use this before closing the backing-store to store the latest bits of data
 	void flush()
 	{
-		std::lock_guard<std::mutex> lg(mut);
+		ProfiledLockGuard<std::mutex> lg(mut,profiler,0);
 		for (auto mp = mapping.cbegin(); mp != mapping.cend() /* not hoisted */; /* no increment */)
 		{
 		  if (isEditedBuffer[mp->second] == 1)
@@ -136,10 +138,39 @@ public:
 		}
 	}
 
+	// selects how "set" reaches backing-store (see CacheWritePolicy.h), default is WRITE_BACK
+	// 		WRITE_THROUGH: every set calls writeMiss, slots are never edited (flush has nothing to write)
+	// 		WRITE_AROUND: set of a key that is not cached calls writeMiss without evicting a slot
+	// call before using the cache (not thread-safe)
+	void enableWritePolicy(const CacheWritePolicy policy)
+	{
+		writePolicy = policy;
+	}
+
+	// starts recording lock statistics of thread-safe methods (acquisitions, contention, wait/hold time histograms)
+	void enableLockProfiler()
+	{
+		profiler.enable(1);
+	}
+
+	// lock statistics, example: cache.getLockProfiler().report(std::cout);
+	const LockProfiler & getLockProfiler() const
+	{
+		return profiler;
+	}
+
 	// CLOCK algorithm with 2 hand counters (1 for second chance for a cache slot to survive, 1 for eviction of cache slot)
 	// opType=0: get
 	// opType=1: set
 	LruValue const accessClock2Hand(const LruKey & key,const LruValue * value, const bool opType = 0)
+	{
+		return accessWith(key,value,opType,loadData,saveData);
+	}
+
+	// same as accessClock2Hand but cache-misses call load(key) / save(key,value) instead of readMiss / writeMiss
+	// 		load and save are template parameters so that a lambda calling next cache level is inlined (see CacheHierarchy.h)
+	template<typename Load, typename Save>
+	LruValue const accessWith(const LruKey & key,const LruValue * value, const bool opType, const Load & loadData, const Save & saveData)
 	{
 
 		// check if it is a cache-hit (in-cache)
@@ -150,11 +181,19 @@ public:
 			chanceToSurviveBuffer[it->second]=1;
 			if(opType == 1)
 			{
-				isEditedBuffer[it->second]=1;
+				isEditedBuffer[it->second]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
 				valueBuffer[it->second]=*value;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					saveData(key,*value);
 			}
 			return valueBuffer[it->second];
 		}
+		else if(opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND)
+		{
+			// write-around: slots keep their items
+			saveData(key,*value);
+			return *value;
+		}
 		else // could not found key in cache, so searching in circular-buffer starts
 		{
 			long long ctrFound = -1;
@@ -207,7 +246,7 @@ public:
 				if(opType==0)
 				{
 					const LruValue && loadedData = loadData(key);
-					mapping.erase(keyBuffer[ctrFound]);
+					unmapSlot(ctrFound);
 					valueBuffer[ctrFound]=loadedData;
 					chanceToSurviveBuffer[ctrFound]=0;
 
@@ -218,7 +257,7 @@ public:
 				}
 				else /* "set" */
 				{
-					mapping.erase(keyBuffer[ctrFound]);
+					unmapSlot(ctrFound);
 
 
 					valueBuffer[ctrFound]=*value;
@@ -226,6 +265,11 @@ public:
 
 					mapping.emplace(key,ctrFound);
 					keyBuffer[ctrFound]=key;
+					if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					{
+						isEditedBuffer[ctrFound]=0;
+						saveData(key,*value);
+					}
 					return *value;
 				}
 			}
@@ -234,14 +278,14 @@ public:
 				// "set"
 				if(opType == 1)
 				{
-					isEditedBuffer[ctrFound]=1;
+					isEditedBuffer[ctrFound]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
 				}
 
 				// "get"
 				if(opType == 0)
 				{
 					const LruValue && loadedData = loadData(key);
-					mapping.erase(keyBuffer[ctrFound]);
+					unmapSlot(ctrFound);
 					valueBuffer[ctrFound]=loadedData;
 					chanceToSurviveBuffer[ctrFound]=0;
 
@@ -252,7 +296,7 @@ public:
 				}
 				else // "set"
 				{
-					mapping.erase(keyBuffer[ctrFound]);
+					unmapSlot(ctrFound);
 
 
 					valueBuffer[ctrFound]=*value;
@@ -260,6 +304,8 @@ public:
 
 					mapping.emplace(key,ctrFound);
 					keyBuffer[ctrFound]=key;
+					if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+						saveData(key,*value);
 					return *value;
 				}
 			}
@@ -267,10 +313,29 @@ public:
 		}
 	}
 
+	// thread-safe version of accessWith
+	template<typename Load, typename Save>
+	inline
+	LruValue const accessThreadSafeWith(const LruKey & key,const LruValue * value, const bool opType, const Load & load, const Save & save)
+	{
+		ProfiledLockGuard<std::mutex> lg(mut,profiler,0);
+		return accessWith(key,value,opType,load,save);
+	}
 
 private:
+	// removes key of a slot from mapping only if mapping points to that slot
+	// (an unused slot holds LruKey() and a flushed slot keeps its key after leaving mapping, both can alias a key that lives in another slot)
+	inline
+	void unmapSlot(const ClockHandInteger slot)
+	{
+		auto victim = mapping.find(keyBuffer[slot]);
+		if(victim != mapping.end() && victim->second == slot)
+			mapping.erase(victim);
+	}
+
 	const ClockHandInteger size;
 	std::mutex mut;
+	LockProfiler profiler;
 	std::unordered_map<LruKey,ClockHandInteger> mapping;
 	std::vector<LruValue> valueBuffer;
 	std::vector<unsigned char> chanceToSurviveBuffer;
@@ -278,6 +343,7 @@ private:
 	std::vector<LruKey> keyBuffer;
 	const std::function<LruValue(LruKey)>  loadData;
 	const std::function<void(LruKey,LruValue)>  saveData;
+	CacheWritePolicy writePolicy;
 	ClockHandInteger ctr;
 	ClockHandInteger ctrEvict;
 };
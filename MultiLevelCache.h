@@ -10,16 +10,32 @@
 
 #include "integer_key_specialization/DirectMappedMultiThreadCache.h"
 #include "integer_key_specialization/NWaySetAssociativeMultiThreadCache.h"
+#include "integer_key_specialization/DirectMappedCache.h"
+#include "integer_key_specialization/CoherenceDirectory.h"
+#include "integer_key_specialization/CacheSizeTuner.h"
+#include<vector>
+#include<memory>
+#include<mutex>
+#include<atomic>
+#include<numeric>
+#include<algorithm>
 
 //	integer key type, any value type, thread-safe, read-write coherent, multi-level cache that is made of
 //		direct mapped (+sharded) L1 cache as front-end and n-way set-associative LRU approximation (+sharded) cache as back-end
 //	single instance can be used directly from multiple threads without extra initialization
+//	for big values, CacheValue = ValueHandle<V> (ValueHandle.h) makes L1/L2/backing-store exchange shared pointers instead of copying values
 template<typename CacheKey=size_t, typename CacheValue=size_t>
 class MultiLevelCache
 {
 public:
 	// by default, 64k L1 tags + 256k L2 tags
 	MultiLevelCache(const std::function<CacheValue(CacheKey)> & readCacheMiss, const std::function<void(CacheKey,CacheValue)> & writeCacheMiss):
+		loadData(readCacheMiss),
+		saveData(writeCacheMiss),
+		exclusive(false),
+		flushing(0),
+		instanceId(instanceCounter.fetch_add(1)+1),
+		privateL1size(0),
 		L2(256,1024, readCacheMiss, writeCacheMiss),
 		L1(1024*64,[this](CacheKey key){ return this->L2.getThreadSafe(key); },[this](CacheKey key, CacheValue value){ this->L2.setThreadSafe(key,value); })
 	{
@@ -30,9 +46,17 @@ public:
 	// L2sets = number of sets in L2 (has to be power of 2)
 	// L2tagsPerSet = number of tags in each set
 	// L2size = L2sets * L2tagsPerSet
-	MultiLevelCache(size_t L1size, size_t L2sets, size_t L2tagsPerSet,const std::function<CacheValue(CacheKey)> & readCacheMiss, const std::function<void(CacheKey,CacheValue)> & writeCacheMiss):
+	// L1lockStripes = number of mutexes shared by L1 tags (0 = min(L1size,4096)), see StripedLockTable.h
+	MultiLevelCache(size_t L1size, size_t L2sets, size_t L2tagsPerSet,const std::function<CacheValue(CacheKey)> & readCacheMiss, const std::function<void(CacheKey,CacheValue)> & writeCacheMiss,
+			const size_t L1lockStripes = 0):
+		loadData(readCacheMiss),
+		saveData(writeCacheMiss),
+		exclusive(false),
+		flushing(0),
+		instanceId(instanceCounter.fetch_add(1)+1),
+		privateL1size(0),
 		L2(L2sets,L2tagsPerSet, readCacheMiss, writeCacheMiss),
-		L1(L1size,[this](CacheKey key){ return this->L2.getThreadSafe(key); },[this](CacheKey key, CacheValue value){ this->L2.setThreadSafe(key,value); })
+		L1(L1size,[this](CacheKey key){ return this->L2.getThreadSafe(key); },[this](CacheKey key, CacheValue value){ this->L2.setThreadSafe(key,value); },true,L1lockStripes)
 	{
 
 	}
@@ -40,34 +64,322 @@ public:
 	inline
 	CacheValue get(const CacheKey & key) noexcept
 	{
+		tune(key,false);
 		return L1.get(key);
 	}
 
 	inline
 	CacheValue getThreadSafe(const CacheKey & key) noexcept
 	{
-		return L1.getThreadSafe(key);
+		if(privateL1size == 0)
+		{
+			tune(key,false);
+			return L1.getThreadSafe(key);
+		}
+
+		DirectMappedCache<CacheKey,VersionedValue<CacheValue>> & P1 = privateL1();
+		return directory->template read<CacheValue>(key,[&](const CacheKey & k, const VersionedValue<CacheValue> * v, const bool opType, const auto & load){
+			return P1.accessWith(k,v,opType,load,Copy::dropEvicted);
+		},[&](const CacheKey & k){ tune(k,false); return L1.getThreadSafe(k); });
 	}
 
 	inline
 	void set(const CacheKey & key, const CacheValue & value) noexcept
 	{
-		L1.set(key,value);
+		tune(key,true);
+		if(privateL1size == 0)
+			L1.set(key,value);
+		else
+			directory->write(key,[&](){ L1.set(key,value); });
 	}
 
 	inline
 	void setThreadSafe(const CacheKey & key, const CacheValue & value) noexcept
 	{
-		L1.setThreadSafe(key,value);
+		tune(key,true);
+		if(privateL1size == 0)
+		{
+			L1.setThreadSafe(key,value);
+			return;
+		}
+
+		const uint64_t version = directory->write(key,[&](){ L1.setThreadSafe(key,value); });
+		const VersionedValue<CacheValue> copy{value,version};
+		privateL1().accessWith(key,&copy,1,Copy::noLoad,Copy::dropEvicted);
+	}
+
+	// attaches a stride-detecting prefetcher to L1: sequential/strided scans preload next "degree" keys from L2 on each miss
+	// keyLimit: number of keys of backing-store, only keys in [0,keyLimit) are prefetched
+	// call before using the cache (not thread-safe)
+	void enablePrefetcher(const CacheKey keyLimit, const int numStreams=4, const int degree=4)
+	{
+		L1.enablePrefetcher(keyLimit,numStreams,degree);
+	}
+
+	// selects which L1 misses install their key into L1 (see InsertionFilter.h), default is ALWAYS
+	// 		SECOND_ACCESS: keys used once (bulk scans over many keys) are served from L2 without evicting L1 items
+	// 		STREAM_BYPASS: sequential/strided scans are served from L2 without evicting L1 items
+	// not used in exclusive mode
+	// call before using the cache (not thread-safe)
+	void enableL1InsertionPolicy(const CacheInsertionPolicy policy, const size_t historySize = 1024*4)
+	{
+		L1.enableInsertionPolicy(policy,historySize);
+	}
+
+	// selects how "set" reaches backing-store (see CacheWritePolicy.h), same policy for L1 and L2, default is WRITE_BACK
+	// 		WRITE_THROUGH: setThreadSafe writes L1, L2 and backing-store before returning (flush has nothing to write)
+	// 		WRITE_AROUND: set of a key that is in neither level writes backing-store without evicting L1 or L2 items
+	// 					  (a key that is only in L2 is updated in L2), bulk writes do not replace items that are read
+	// not used in exclusive mode
+	// call before using the cache (not thread-safe)
+	void enableWritePolicy(const CacheWritePolicy policy)
+	{
+		L1.enableWritePolicy(policy);
+		L2.enableWritePolicy(policy);
+	}
+
+	// exclusive hierarchy: an item is either in L1 or in L2, not in both (default is inclusive: L2 keeps a copy of each L1 item)
+	// 		L1 miss moves the item out of L2 (or reads backing-store directly if it is not in L2)
+	// 		every item evicted from L1 (clean or edited) moves into L2 with its edited status
+	// 		total capacity becomes L1size + L2size, useful for big values
+	// 		L2 does not see L1 hits, so a hot L1 item does not hold an L2 slot
+	// call before using the cache (not thread-safe)
+	void enableExclusiveMode()
+	{
+		exclusive = true;
+
+		// during flush(), an edited item that moves between levels is written to backing-store first and moves as clean
+		// (otherwise it could move from a level that is not scanned yet to a level that is already scanned)
+		L1.enableExclusiveMode([this](CacheKey key, bool & dirty){
+			CacheValue value;
+			if(this->L2.extractThreadSafe(key,value,dirty))
+			{
+				if(dirty && this->flushing.load() > 0)
+				{
+					this->saveData(key,value);
+					dirty = false;
+				}
+				return value;
+			}
+			dirty = false;
+			return this->loadData(key);
+		},[this](CacheKey key, CacheValue value, bool dirty){
+			if(dirty && this->flushing.load() > 0)
+			{
+				this->saveData(key,value);
+				dirty = false;
+			}
+			this->L2.insertThreadSafe(key,value,dirty);
+		},[this](CacheKey key){
+			// old copy of a write-miss is dropped, but it may be the only copy of a write that flush() has to store
+			CacheValue value;
+			bool dirty;
+			if(this->L2.extractThreadSafe(key,value,dirty) && dirty && this->flushing.load() > 0)
+				this->saveData(key,value);
+		});
+	}
+
+	// gives each thread that calls getThreadSafe/setThreadSafe its own unlocked direct-mapped L1 in front of shared L1 (created on first call of thread)
+	// 		private L1 is write-through: setThreadSafe writes shared L1 and increases version of key in a CoherenceDirectory
+	//		a private copy is used only while version of its key is unchanged (1 atomic load per hit, no lock), otherwise it is re-read from shared L1
+	// 		private L1 of an ended thread is given to next thread that needs one (number of private L1s = peak number of threads using the cache)
+	// privateL1tags: number of tags of each private L1 (has to be power of 2)
+	// directorySize: number of version counters shared by all threads (8 bytes each), see CoherenceDirectory.h
+	// call before using the cache (not thread-safe)
+	void enablePrivateL1(const size_t privateL1tags, const size_t directorySize = 1024*64)
+	{
+		directory = std::make_unique<CoherenceDirectory>(directorySize);
+		privateL1pool = std::make_shared<PrivateL1Pool>();
+		privateL1size = privateL1tags;
+	}
+
+	// resizes L1 and L2 at run-time toward lowest average access cost, estimated by shadow tags of a sample of keys (see CacheSizeTuner.h)
+	// 		total number of tags (L1size + L2sets x L2tagsPerSet of constructor) does not change: L1 is one of L1size, L1size/2, ... minL1size, L2 has the rest
+	// 		L1 stays allocated for L1size tags (lock-free readers need it), L2 memory follows its size
+	// 		resizing locks all tags of a level for a moment, items that do not fit new size are evicted (edited ones written to next level)
+	// minL1size: smallest L1 (power of 2), L1 lock stripes (see L1lockStripes of constructor) are reduced to minL1size if there are more
+	// L2cost, missCost: cost of an L2 hit and of a backing-store access, relative to an L1 hit
+	// samplingRate: 1 of samplingRate L1 tags is simulated, samplesPerDecision: number of simulated accesses between 2 decisions
+	// simulation assumes inclusive hierarchy (exclusive mode and insertion policies are not modeled)
+	// call before using the cache (not thread-safe, L2 content is discarded)
+	void enableAutoTuning(const size_t minL1size, const double L2cost = 10, const double missCost = 100,
+			const size_t samplingRate = 64, const size_t samplesPerDecision = 1024*16)
+	{
+		const std::vector<size_t> tagsOfSets = L2.capacities();
+		const size_t L1size = L1.activeSize();
+		L1.enableResizing(minL1size);
+		const size_t minL1 = std::min(std::max(minL1size,L1.minimumSize()),L1size);
+		const size_t budget = L1size + std::accumulate(tagsOfSets.begin(),tagsOfSets.end(),(size_t)0);
+		L2sets = tagsOfSets.size();
+		tuningBudget = budget;
+		L2.enableResizing((budget - minL1)/L2sets);
+		tuner = std::make_unique<CacheSizeTuner<CacheKey>>(L1size,minL1,budget,L1size,L2cost,missCost,samplingRate,samplesPerDecision);
+	}
+
+	// current number of L1 tags (changes only with enableAutoTuning)
+	size_t sizeL1() const noexcept
+	{
+		return L1.activeSize();
+	}
+
+	// current number of L2 tags (changes only with enableAutoTuning)
+	size_t sizeL2()
+	{
+		const std::vector<size_t> tagsOfSets = L2.capacities();
+		return std::accumulate(tagsOfSets.begin(),tagsOfSets.end(),(size_t)0);
 	}
 
-	// call before shutting program/connection down and after all read/write of other threads are complete
-	void flush()
+	// writes all edited items to backing-store, items stay in cache as clean
+	// can be called while other threads use getThreadSafe/setThreadSafe (online checkpoint), a tag/set is locked only while 1 edited item is written
+	// 		every write that completed before flush() started is in backing-store when flush() returns
+	// 		items written again during flush stay edited for next flush
+	// call also before shutting program/connection down, after all read/write of other threads are complete
+	// parallelism: number of threads that flush tags of L1 and then sets of L2 in parallel (L2 starts after L1 is complete)
+	//				1 = calling thread only, 0 = std::thread::hardware_concurrency()
+	//				helper threads are started and joined by each call (see parallelFor in ParallelFor.h)
+	//				writeCacheMiss is called from multiple threads when parallelism != 1
+	// private L1s (enablePrivateL1) are never edited, they do not need flushing
+	void flush(const int parallelism = 1)
 	{
-		L1.flush();
-		L2.flush();
+		flushing.fetch_add(1);
+		if(exclusive)
+		{
+			// L2 does not have copies of L1 items
+			L1.flushWith(saveData,parallelism);
+		}
+		else
+		{
+			// edited L1 items go to L2 (L2 copy has to be updated), then L2 writes them
+			L1.flush(parallelism);
+		}
+		L2.flush(parallelism);
+		flushing.fetch_sub(1);
 	}
 private:
+	using Copy = VersionedCopy<CacheKey,CacheValue>;
+	using PrivateL1 = DirectMappedCache<CacheKey,VersionedValue<CacheValue>>;
+
+	// private L1s of an instance
+	// threads keep a weak_ptr to it: an ending thread gives its L1 back only if the instance still exists
+	struct PrivateL1Pool
+	{
+		std::mutex mut;
+		std::vector<std::unique_ptr<PrivateL1>> all;
+		std::vector<PrivateL1 *> unused;
+	};
+
+	struct Registration
+	{
+		uint64_t instance;
+		PrivateL1 * cache;
+		std::weak_ptr<PrivateL1Pool> pool;
+	};
+
+	// registrations of a thread, private L1s go back to their pools when thread ends
+	struct ThreadRegistrations
+	{
+		std::vector<Registration> list;
+		~ThreadRegistrations()
+		{
+			for(const auto & r:list)
+			{
+				if(auto pool = r.pool.lock())
+				{
+					std::lock_guard<std::mutex> lg(pool->mut);
+					pool->unused.push_back(r.cache);
+				}
+			}
+		}
+	};
+
+	// feeds an L1 access to auto-tuner, resizes levels when tuner selects another L1 size
+	// called before L1 is accessed (no lock of L1 or L2 is held)
+	inline
+	void tune(const CacheKey & key, const bool write)
+	{
+		size_t newL1size;
+		if(tuner && tuner->sample(key,write,newL1size))
+		{
+			std::lock_guard<std::mutex> lg(tuningMut);
+			const size_t newL2tags = (tuningBudget - newL1size)/L2sets;
+
+			// shrinking level first: items evicted from a shrinking L1 are written to L2
+			if(newL1size < L1.activeSize())
+			{
+				L1.resize(newL1size);
+				L2.resize(newL2tags);
+			}
+			else
+			{
+				L2.resize(newL2tags);
+				L1.resize(newL1size);
+			}
+		}
+	}
+
+	// private L1 of calling thread for this instance (thread-local registration)
+	inline
+	PrivateL1 & privateL1()
+	{
+		// a thread mostly uses 1 instance
+		static thread_local uint64_t lastInstance = 0;
+		static thread_local PrivateL1 * lastCache = nullptr;
+		static thread_local ThreadRegistrations registrations;
+		if(lastInstance == instanceId)
+			return *lastCache;
+
+		// registrations of destroyed instances are dropped while searching
+		auto & list = registrations.list;
+		list.erase(std::remove_if(list.begin(),list.end(),[](const Registration & r){ return r.pool.expired(); }),list.end());
+		for(const auto & r:list)
+		{
+			if(r.instance == instanceId)
+			{
+				lastInstance = r.instance;
+				lastCache = r.cache;
+				return *r.cache;
+			}
+		}
+
+		// L1 of an ended thread is reused, its copies are checked against directory versions like any other copy
+		PrivateL1 * cache = nullptr;
+		{
+			std::lock_guard<std::mutex> lg(privateL1pool->mut);
+			if(privateL1pool->unused.empty())
+			{
+				privateL1pool->all.push_back(std::make_unique<PrivateL1>(privateL1size,[this](CacheKey key){
+					const uint64_t version = this->directory->version(key);
+					return VersionedValue<CacheValue>{this->L1.getThreadSafe(key),version};
+				},[](CacheKey, VersionedValue<CacheValue>){ }));
+				cache = privateL1pool->all.back().get();
+			}
+			else
+			{
+				cache = privateL1pool->unused.back();
+				privateL1pool->unused.pop_back();
+			}
+		}
+		list.push_back(Registration{instanceId,cache,privateL1pool});
+		lastInstance = instanceId;
+		lastCache = cache;
+		return *cache;
+	}
+
+	// ids are never reused, so registration of a destroyed instance does not match a new instance at same address
+	inline static std::atomic<uint64_t> instanceCounter{0};
+
+	const std::function<CacheValue(CacheKey)> loadData;
+	const std::function<void(CacheKey,CacheValue)> saveData;
+	bool exclusive;
+	std::atomic<int> flushing;
+	const uint64_t instanceId;
+	size_t privateL1size;
+	std::unique_ptr<CoherenceDirectory> directory;
+	std::shared_ptr<PrivateL1Pool> privateL1pool;
+	std::unique_ptr<CacheSizeTuner<CacheKey>> tuner;
+	std::mutex tuningMut;
+	size_t tuningBudget;
+	size_t L2sets;
 	NWaySetAssociativeMultiThreadCache<CacheKey,CacheValue> L2;
 	DirectMappedMultiThreadCache<CacheKey,CacheValue> L1;
 
@@ -0,0 +1,134 @@
+/*
+ * NumaMultiLevelCache.h
+ *
+ *  Created on: Nov 16, 2021
+ *      Author: tugrul
+ */
+
+#ifndef NUMAMULTILEVELCACHE_H_
+#define NUMAMULTILEVELCACHE_H_
+
+#include<vector>
+#include<memory>
+#include<functional>
+#include<thread>
+#include "integer_key_specialization/DirectMappedMultiThreadCache.h"
+#include "integer_key_specialization/NWaySetAssociativeMultiThreadCache.h"
+#include "integer_key_specialization/CoherenceDirectory.h"
+#include "integer_key_specialization/NumaTopology.h"
+#include "integer_key_specialization/KeyMixer.h"
+
+//	NUMA-aware version of MultiLevelCache: integer key type, any value type, thread-safe, read-write coherent
+//		each NUMA node has its own L1 and L2, both allocated and initialized by a thread bound to that node (first-touch = node-local memory)
+//		L2 of a node owns 1/numNodes of keys (selected by hash of key): only owner L2 reads/writes backing-store for those keys
+//		L1 of a node keeps replicas of any key that is used by threads of that node, so read-mostly keys are read from local memory on all nodes
+//		a write goes to owner L2 and increases version of key in a CoherenceDirectory, replicas of older version are re-read from owner on next access
+//		calling thread is routed to L1 of its own node automatically (sched_getcpu)
+//	single instance can be used directly from multiple threads without extra initialization
+template<typename CacheKey=size_t, typename CacheValue=size_t>
+class NumaMultiLevelCache
+{
+public:
+	// L1size = number of tags in L1 of each node (has to be power of 2)
+	// L2sets = number of sets in L2 of each node (has to be power of 2)
+	// L2tagsPerSet = number of tags in each set
+	// numNodes = 0: detected from /sys/devices/system/node, otherwise threads are spread on numNodes nodes by their CPU index (see NumaTopology.h)
+	// directorySize = number of version counters shared by all nodes (8 bytes each), see CoherenceDirectory.h
+	NumaMultiLevelCache(size_t L1size, size_t L2sets, size_t L2tagsPerSet,const std::function<CacheValue(CacheKey)> & readCacheMiss, const std::function<void(CacheKey,CacheValue)> & writeCacheMiss,
+			const int numNodes = 0, const size_t directorySize = 1024*64):
+		topology(numNodes),
+		directory(directorySize),
+		nodes(topology.size())
+	{
+		for(int i=0;i<topology.size();i++)
+		{
+			topology.runOnNode(i,[&](){
+				nodes[i].L2 = std::make_unique<NWaySetAssociativeMultiThreadCache<CacheKey,CacheValue>>(L2sets,L2tagsPerSet,readCacheMiss,writeCacheMiss);
+
+				// L1 never has data that is newer than owner L2 (write-through), evicted replicas are dropped
+				nodes[i].L1 = std::make_unique<DirectMappedMultiThreadCache<CacheKey,VersionedValue<CacheValue>>>(L1size,[this](CacheKey key){
+					const uint64_t version = this->directory.version(key);
+					return VersionedValue<CacheValue>{this->ownerOf(key).getThreadSafe(key),version};
+				},[](CacheKey, VersionedValue<CacheValue>){ });
+			});
+		}
+	}
+
+	inline
+	CacheValue getThreadSafe(const CacheKey & key) noexcept
+	{
+		auto & L1 = *nodes[topology.currentNode()].L1;
+		auto & owner = ownerOf(key);
+
+		return directory.template read<CacheValue>(key,[&](const CacheKey & k, const VersionedValue<CacheValue> * v, const bool opType, const auto & load){
+			return L1.accessThreadSafeWith(k,v,opType,load,Copy::dropEvicted);
+		},[&](const CacheKey & k){ return owner.getThreadSafe(k); });
+	}
+
+	inline
+	void setThreadSafe(const CacheKey & key, const CacheValue & value) noexcept
+	{
+		auto & L1 = *nodes[topology.currentNode()].L1;
+		auto & owner = ownerOf(key);
+		const uint64_t version = directory.write(key,[&](){ owner.setThreadSafe(key,value); });
+		const VersionedValue<CacheValue> replica{value,version};
+		L1.accessThreadSafeWith(key,&replica,1,Copy::noLoad,Copy::dropEvicted);
+	}
+
+	// number of nodes used (1 L1 + 1 L2 per node)
+	int numberOfNodes() const noexcept
+	{
+		return topology.size();
+	}
+
+	// node that owns key (its L2 reads/writes backing-store for key)
+	// selected by upper half of hash (multiply-high), L2 selects a set by lowest bits of same hash so each node uses all of its sets
+	// (half of size_t width: 32 bits on 64-bit targets, 16 bits on 32-bit targets)
+	inline
+	int nodeOfKey(const CacheKey & key) const noexcept
+	{
+		constexpr int halfBits = (int)sizeof(size_t)*4;
+		const uint64_t high = (uint64_t)(hasher(key) >> halfBits);
+		return (int)((high * (uint64_t)topology.size()) >> halfBits);
+	}
+
+	// writes all edited items to backing-store, items stay in cache as clean
+	// can be called while other threads use the cache (a set of L2 is locked only while 1 edited item is written), also call it before shutting program/connection down
+	// only L2 of nodes have edited data, each node is flushed by a thread of that node
+	// parallelism: number of threads that flush sets of L2 of a node in parallel (1 = one thread per node, 0 = std::thread::hardware_concurrency())
+	void flush(const int parallelism = 1)
+	{
+		std::vector<std::thread> workers;
+		for(int i=0;i<topology.size();i++)
+		{
+			workers.emplace_back([&,i](){
+				topology.bindCurrentThread(i);
+				nodes[i].L2->flush(parallelism);
+			});
+		}
+		for(auto & worker:workers)
+			worker.join();
+	}
+private:
+	struct Node
+	{
+		std::unique_ptr<DirectMappedMultiThreadCache<CacheKey,VersionedValue<CacheValue>>> L1;
+		std::unique_ptr<NWaySetAssociativeMultiThreadCache<CacheKey,CacheValue>> L2;
+	};
+
+	using Copy = VersionedCopy<CacheKey,CacheValue>;
+
+	inline
+	NWaySetAssociativeMultiThreadCache<CacheKey,CacheValue> & ownerOf(const CacheKey & key) noexcept
+	{
+		return *nodes[nodeOfKey(key)].L2;
+	}
+
+	const NumaTopology topology;
+	CoherenceDirectory directory;
+	std::vector<Node> nodes;
+	IntegerKeyMixer<CacheKey> hasher;
+};
+
+
+#endif /* NUMAMULTILEVELCACHE_H_ */
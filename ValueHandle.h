@@ -0,0 +1,111 @@
+/*
+ * ValueHandle.h
+ *
+ *  Created on: Nov 18, 2021
+ *      Author: tugrul
+ */
+
+#ifndef VALUEHANDLE_H_
+#define VALUEHANDLE_H_
+
+#include<memory>
+#include<utility>
+#include<type_traits>
+
+/* shared immutable value for caches with big values (std::string, std::vector, image chunks, ...)
+ * value is allocated once (when it is read from backing-store or set by user) and all cache levels keep a reference to it
+ * 		L2 -> L1 promotion, L1 -> L2 eviction and get() copy a pointer + increase a reference counter instead of copying the value
+ * 		value is released when no cache level and no user holds it
+ * a handle never changes its value: set() of a key creates a new value, handles returned by earlier get() calls keep old value
+ * usable as CacheValue of all caches, for example:
+ * 		MultiLevelCache<int,ValueHandle<std::string>> cache(L1size,L2sets,L2tagsPerSet,
+ * 			[&](int key){ return database[key]; },									// std::string converts to ValueHandle
+ * 			[&](int key, ValueHandle<std::string> value){ database[key]=*value; });
+ * 		cache.set(5,std::string(1000,'a')); 	// 1 allocation, levels share it
+ * 		const auto handle = cache.get(5);		// keep the handle: it keeps the string alive even if cache evicts it
+ * 		const std::string & s = *handle;		// no string copy, valid while handle lives
+ * reference counting is atomic (thread-safe), many threads getting same handle at same time share a counter (prefer per-thread L1 for hot keys)
+ */
+template<typename T>
+class ValueHandle
+{
+public:
+	// empty handle, reads as T()
+	ValueHandle() noexcept
+	{
+
+	}
+
+	// takes value into a new shared allocation
+	ValueHandle(const T & value):ptr(std::make_shared<const T>(value))
+	{
+
+	}
+
+	ValueHandle(T && value):ptr(std::make_shared<const T>(std::move(value)))
+	{
+
+	}
+
+	// shares an existing allocation
+	ValueHandle(std::shared_ptr<const T> value) noexcept:ptr(std::move(value))
+	{
+
+	}
+
+	inline
+	const T & operator*() const noexcept
+	{
+		return ptr ? *ptr : emptyValue();
+	}
+
+	inline
+	const T * operator->() const noexcept
+	{
+		return &(**this);
+	}
+
+	// implicit conversion lets miss functions with T parameters be used as writeMiss
+	inline
+	operator const T & () const noexcept
+	{
+		return **this;
+	}
+
+	// true if handle refers to a value
+	inline
+	explicit operator bool() const noexcept
+	{
+		return (bool)ptr;
+	}
+
+	inline
+	const std::shared_ptr<const T> & shared() const noexcept
+	{
+		return ptr;
+	}
+
+	// compares values (handles of same allocation are equal without comparing values)
+	inline
+	bool operator==(const ValueHandle & other) const
+	{
+		return ptr == other.ptr || **this == *other;
+	}
+
+	inline
+	bool operator!=(const ValueHandle & other) const
+	{
+		return !(*this == other);
+	}
+private:
+	static const T & emptyValue() noexcept
+	{
+		static const T empty{};
+		return empty;
+	}
+
+	std::shared_ptr<const T> ptr;
+};
+
+
+#endif /* VALUEHANDLE_H_ */
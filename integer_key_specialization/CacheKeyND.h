@@ -0,0 +1,88 @@
+/*
+ * CacheKeyND.h
+ *
+ *  Created on: Nov 6, 2021
+ *      Author: tugrul
+ */
+
+#ifndef CACHEKEYND_H_
+#define CACHEKEYND_H_
+
+#include<cstddef>
+#include<utility>
+#include<functional>
+
+// maps each element of a parameter pack to same type T
+// used for expanding "CacheKey" once per dimension: RepeatForDimension<CacheKey,Dims>... = CacheKey,CacheKey,...
+template<typename T, size_t Dimension>
+using RepeatForDimension = T;
+
+// cache-miss function types with N coordinates
+// 		ReadMissFunctionND<int,float,3> 	= std::function<float(int,int,int)>
+// 		WriteMissFunctionND<int,float,3> 	= std::function<void(int,int,int,float)>
+template<typename CacheKey, typename CacheValue, typename DimensionSequence>
+struct MissFunctionND;
+
+template<typename CacheKey, typename CacheValue, size_t ... Dimension>
+struct MissFunctionND<CacheKey,CacheValue,std::index_sequence<Dimension...>>
+{
+	using Read = std::function<CacheValue(RepeatForDimension<CacheKey,Dimension>...)>;
+	using Write = std::function<void(RepeatForDimension<CacheKey,Dimension>...,CacheValue)>;
+	using ReadTile = std::function<void(RepeatForDimension<CacheKey,Dimension>...,CacheValue *)>;
+	using WriteTile = std::function<void(RepeatForDimension<CacheKey,Dimension>...,const CacheValue *)>;
+};
+
+template<typename CacheKey, typename CacheValue, size_t N>
+using ReadMissFunctionND = typename MissFunctionND<CacheKey,CacheValue,std::make_index_sequence<N>>::Read;
+
+template<typename CacheKey, typename CacheValue, size_t N>
+using WriteMissFunctionND = typename MissFunctionND<CacheKey,CacheValue,std::make_index_sequence<N>>::Write;
+
+// tile versions: first element's coordinates + pointer to row-major tile data
+// 		ReadTileFunctionND<int,float,2> 	= std::function<void(int,int,float *)>
+// 		WriteTileFunctionND<int,float,2> 	= std::function<void(int,int,const float *)>
+template<typename CacheKey, typename CacheValue, size_t N>
+using ReadTileFunctionND = typename MissFunctionND<CacheKey,CacheValue,std::make_index_sequence<N>>::ReadTile;
+
+template<typename CacheKey, typename CacheValue, size_t N>
+using WriteTileFunctionND = typename MissFunctionND<CacheKey,CacheValue,std::make_index_sequence<N>>::WriteTile;
+
+/* packed multi-dimensional integer key
+ * k[0]=x, k[1]=y, k[2]=z, k[3]=w, ...
+ * default value is (CacheKey()-1) for all coordinates, same as the empty-slot marker of other direct-mapped caches
+ */
+template<typename CacheKey, size_t N>
+struct CacheKeyND
+{
+	CacheKeyND()
+	{
+		for(size_t i=0;i<N;i++)
+			k[i]=CacheKey()-1;
+	}
+
+	template<typename ... Keys>
+	CacheKeyND(const CacheKey & key0, const Keys & ... keys):k{key0,(CacheKey)keys...}
+	{
+		static_assert(sizeof...(Keys)+1 == N,"CacheKeyND requires N coordinates");
+	}
+
+	inline
+	bool operator == (const CacheKeyND & key) const noexcept
+	{
+		bool result = true;
+		for(size_t i=0;i<N;i++)
+			result &= (k[i]==key.k[i]);
+		return result;
+	}
+
+	inline
+	bool operator != (const CacheKeyND & key) const noexcept
+	{
+		return !(*this == key);
+	}
+
+	CacheKey k[N];
+};
+
+
+#endif /* CACHEKEYND_H_ */
@@ -0,0 +1,189 @@
+/*
+ * CacheSizeTuner.h
+ *
+ *  Created on: Nov 19, 2021
+ *      Author: tugrul
+ */
+
+#ifndef CACHESIZETUNER_H_
+#define CACHESIZETUNER_H_
+
+#include<vector>
+#include<memory>
+#include<mutex>
+#include<algorithm>
+#include"KeyMixer.h"
+#include"../LruClockCache.h"
+
+/* selects L1/L2 split of a fixed number of tags (budget) for a 2-level cache: direct-mapped L1 + LRU approximation L2 (see MultiLevelCache::enableAutoTuning)
+ * candidates: L1 size = maxL1size, maxL1size/2, ... minL1size, L2 size = budget - L1 size
+ * every candidate is simulated on a sample of keys by shadow tags (keys only, no values, no backing-store access) = "what-if" hit/miss counters for each level
+ * 		sampled keys: 1 of samplingRate tags of smallest L1 is selected by hash, keys of selected tags are sampled
+ * 					  a selected tag of smallest L1 selects same subset of tags in every bigger L1, so shadow L1 sees every key of its tags (same conflicts as real L1)
+ * 		shadow L1 of a candidate: direct-mapped, only selected tags
+ * 		shadow L2 of a candidate: LRU-CLOCK (LruClockCache) with (L2 size x sampled fraction of tags) keys, fed by read-misses and edited evictions of shadow L1
+ * cost of a candidate = sampled accesses x 1 + L1 read-misses x L2cost + L2 read-misses x missCost (costs relative to an L1 hit)
+ * every samplesPerDecision samples, cheapest candidate is selected if it is cheaper than current one by more than 1/16, then counters decay by half
+ * thread-safe: sampled accesses are simulated by one thread at a time (a thread that finds the simulation busy skips its sample)
+ */
+template<typename CacheKey>
+class CacheSizeTuner
+{
+public:
+	// maxL1size: power of 2, minL1size: rounded up to power of 2
+	// budget: number of tags of L1 + L2
+	// currentL1size: L1 size that is in use
+	CacheSizeTuner(const size_t maxL1size, const size_t minL1size, const size_t budget, const size_t currentL1size,
+			const double L2cost = 10, const double missCost = 100, const size_t samplingRate = 64, const size_t samplesPerDecision = 1024*16):
+				costL2(L2cost),costMiss(missCost),samplesPerEpoch(samplesPerDecision),numSamples(0),current(0)
+	{
+		minL1 = 1;
+		while(minL1 < minL1size && minL1 < maxL1size)
+			minL1 <<= 1;
+
+		size_t rate = 1;
+		while(rate < samplingRate)
+			rate <<= 1;
+		rateM1 = rate - 1;
+
+		// selected tags of smallest L1 get consecutive ranks (sampling rate is lowered until at least 1 tag is selected)
+		numSampled = 0;
+		while(numSampled == 0)
+		{
+			rank = std::vector<size_t>(minL1,notSampled);
+			for(size_t i=0;i<minL1;i++)
+				if((hasher((CacheKey)i) & rateM1) == 0)
+					rank[i] = numSampled++;
+			rateM1 >>= (numSampled == 0);
+		}
+		minShift = 0;
+		while(((size_t)1<<minShift) < minL1)
+			minShift++;
+
+		for(size_t L1size = std::max(maxL1size,minL1); L1size >= minL1; L1size >>= 1)
+		{
+			candidates.push_back(std::make_unique<Candidate>());
+			Candidate & c = *candidates.back();
+			c.L1size = L1size;
+			c.L1tags = std::vector<CacheKey>(numSampled*(L1size/minL1),CacheKey()-1);
+			c.L1edited = std::vector<unsigned char>(c.L1tags.size(),0);
+			const size_t L2size = (budget > L1size) ? budget - L1size : 0;
+			const size_t L2sampled = std::max(L2size*numSampled/minL1,(size_t)2);
+			c.L2 = std::make_unique<LruClockCache<CacheKey,char>>(L2sampled,[](CacheKey){ return 0; },[](CacheKey,char){ });
+			if(L1size == currentL1size)
+				current = candidates.size()-1;
+		}
+	}
+
+	// called on each access of L1, returns true if another L1 size is selected (then newL1size is set)
+	// write: access is a set (L1 write-miss does not read L2)
+	inline
+	bool sample(const CacheKey & key, const bool write, size_t & newL1size)
+	{
+		const CacheKey tag = key & (CacheKey)(minL1-1);
+		if((hasher(tag) & rateM1) != 0)
+			return false;
+
+		std::unique_lock<std::mutex> lock(mut,std::try_to_lock);
+		if(!lock.owns_lock())
+			return false;
+
+		for(auto & c:candidates)
+			simulate(*c,key,write);
+
+		if(++numSamples < samplesPerEpoch)
+			return false;
+		numSamples = 0;
+
+		size_t best = current;
+		for(size_t i=0;i<candidates.size();i++)
+			if(costOf(*candidates[i]) < costOf(*candidates[best]))
+				best = i;
+		const bool changed = (best != current) && (costOf(*candidates[best])*16 < costOf(*candidates[current])*15);
+		for(auto & c:candidates)
+		{
+			c->accesses *= 0.5;
+			c->L1misses *= 0.5;
+			c->L2misses *= 0.5;
+		}
+		if(!changed)
+			return false;
+		current = best;
+		newL1size = candidates[best]->L1size;
+		return true;
+	}
+
+	// estimated average access cost of each candidate (relative to an L1 hit), for L1 sizes from biggest to smallest
+	std::vector<std::pair<size_t,double>> estimates()
+	{
+		std::lock_guard<std::mutex> lg(mut);
+		std::vector<std::pair<size_t,double>> result;
+		for(auto & c:candidates)
+			result.push_back(std::pair<size_t,double>(c->L1size,(c->accesses>0) ? costOf(*c)/c->accesses : 0));
+		return result;
+	}
+private:
+	static constexpr size_t notSampled = (size_t)-1;
+
+	struct Candidate
+	{
+		Candidate():L1size(0),accesses(0),L1misses(0),L2misses(0){ }
+		size_t L1size;
+		std::vector<CacheKey> L1tags;
+		std::vector<unsigned char> L1edited;
+		std::unique_ptr<LruClockCache<CacheKey,char>> L2;
+		double accesses;
+		double L1misses;
+		double L2misses;
+	};
+
+	// same steps as a write-back direct-mapped L1 in front of an inclusive L2
+	inline
+	void simulate(Candidate & c, const CacheKey & key, const bool write)
+	{
+		const size_t slot = (size_t)(key & (CacheKey)(c.L1size-1));
+		const size_t index = rank[slot & (minL1-1)] + numSampled*(slot >> minShift);
+		c.accesses++;
+		if(c.L1tags[index] == key)
+		{
+			c.L1edited[index] |= write;
+			return;
+		}
+
+		const auto countMiss = [&](const CacheKey &){ c.L2misses++; return (char)0; };
+		const auto noSave = [](const CacheKey &, const char &){ };
+		const char value = 0;
+		if(c.L1edited[index])
+			c.L2->accessWith(c.L1tags[index],&value,1,countMiss,noSave);
+		if(!write)
+		{
+			c.L1misses++;
+			c.L2->accessWith(key,nullptr,0,countMiss,noSave);
+		}
+		c.L1tags[index] = key;
+		c.L1edited[index] = write;
+	}
+
+	inline
+	double costOf(const Candidate & c) const noexcept
+	{
+		return c.accesses + c.L1misses*costL2 + c.L2misses*costMiss;
+	}
+
+	size_t minL1;
+	const double costL2;
+	const double costMiss;
+	const size_t samplesPerEpoch;
+	size_t rateM1;
+	size_t numSampled;
+	size_t minShift;
+	std::vector<size_t> rank;
+	std::vector<std::unique_ptr<Candidate>> candidates;
+	size_t numSamples;
+	size_t current;
+	std::mutex mut;
+	IntegerKeyMixer<CacheKey> hasher;
+};
+
+
+#endif /* CACHESIZETUNER_H_ */
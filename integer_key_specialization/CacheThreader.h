@@ -19,6 +19,8 @@
  * L2: LRU clock cache, for each thread (size must be integer-power of 2)
  * LLC: user-defined cache with thread-safe get/set methods that is slower but global
  * currently only 1 thread is supported
+ * for read+write with multiple threads, use CoherentCacheThreader (CoherentCacheThreader.h)
+ * for big values, CacheValue = ValueHandle<V> (../ValueHandle.h) makes L1, L2 and LLC share one copy of each value
 */
 template<template<typename,typename, typename> class Cache,typename CacheKey, typename CacheValue, typename CacheInternalCounterTypeInteger=size_t>
 class CacheThreader
@@ -68,6 +70,15 @@ public:
 		L1->set(key,value);
 	}
 
+	// selects which L1 misses install their key into L1 (see InsertionFilter.h), default is ALWAYS
+	// 		SECOND_ACCESS: keys used once (bulk scans over many keys) are served from L2 without evicting L1 items
+	// 		STREAM_BYPASS: sequential/strided scans are served from L2 without evicting L1 items
+	// call before using the cache
+	void enableL1InsertionPolicy(const CacheInsertionPolicy policy, const size_t historySize = 1024*4)
+	{
+		L1->enableInsertionPolicy(policy,historySize);
+	}
+
 	// currently only 1 thread supported for read+write
 	// only read-only usage for multi-threaded apps
 	// must be called from all threads
@@ -0,0 +1,117 @@
+/*
+ * CoherenceDirectory.h
+ *
+ *  Created on: Nov 15, 2021
+ *      Author: tugrul
+ */
+
+#ifndef COHERENCEDIRECTORY_H_
+#define COHERENCEDIRECTORY_H_
+
+#include<atomic>
+#include<memory>
+#include<cstdint>
+#include"StripedLockTable.h"
+
+// value of a private copy + version of its directory entry when it was read from shared cache
+template<typename CacheValue>
+struct VersionedValue
+{
+	CacheValue value;
+	uint64_t version;
+};
+
+// load/save functors of a private cache of VersionedValue copies (for accessWith/accessThreadSafeWith)
+// noLoad: a set of a copy does not read shared cache
+// dropEvicted: a copy is never newer than shared cache (writes go through), so an evicted copy is dropped
+template<typename CacheKey, typename CacheValue>
+struct VersionedCopy
+{
+	static constexpr auto noLoad = [](const CacheKey &){ return VersionedValue<CacheValue>(); };
+	static constexpr auto dropEvicted = [](const CacheKey &, const VersionedValue<CacheValue> &){ };
+};
+
+/* version directory for private (per-thread) copies of a shared cache: write-invalidation by epoch-tagged lines
+ * integer key k is tracked by entry (k % numEntries), each entry is a version counter that is increased by every write of its keys
+ * a private copy remembers version of its entry at the time it was read from shared cache
+ * 		copy is valid only while version of entry is unchanged, checking it is a lock-free atomic load (no shared write on a hit)
+ * writers of same entry are serialized by a striped lock table so that shared cache and version are updated in same order by all writers
+ * keys sharing an entry invalidate each other (false invalidation costs an extra read from shared cache, it does not break coherency)
+ * all writes to shared cache have to go through write() of same directory, otherwise private copies can stay stale
+ */
+class CoherenceDirectory
+{
+public:
+	// numEntries: number of version counters (rounded up to integer power of 2), more entries = less false invalidation, 8 bytes each
+	// numLockStripes: number of mutexes for writers, 0 = min(numEntries,4096)
+	CoherenceDirectory(const size_t numEntries = 1024*64, const size_t numLockStripes = 0)
+	{
+		size_t size = 1;
+		while(size < numEntries)
+			size <<= 1;
+		entryM1 = size - 1;
+		versions = std::unique_ptr<std::atomic<uint64_t>[]>(new std::atomic<uint64_t>[size]);
+		for(size_t i=0;i<size;i++)
+			versions[i].store(0,std::memory_order_relaxed);
+		writeLocks = StripedLockTable(size,numLockStripes);
+	}
+
+	// current version of entry of key
+	// read it before reading shared cache: a write that completes after this load makes the copy invalid
+	template<typename CacheKey>
+	inline
+	uint64_t version(const CacheKey & key) const noexcept
+	{
+		return versions[(size_t)key & entryM1].load(std::memory_order_acquire);
+	}
+
+	// runs writeFunc() (writing key to shared cache) under lock of entry of key and then increases version of entry
+	// returns new version (a private copy of written value is valid with this version)
+	template<typename CacheKey, typename WriteFunc>
+	inline
+	uint64_t write(const CacheKey & key, const WriteFunc & writeFunc)
+	{
+		const size_t entry = (size_t)key & entryM1;
+		StripedLockTable::Guard lg(writeLocks,entry);
+		writeFunc();
+		return versions[entry].fetch_add(1,std::memory_order_acq_rel) + 1;
+	}
+
+	// reads key through a private cache of VersionedValue<CacheValue> copies
+	// accessPrivate(key, value pointer, opType, load): get/set of private cache (its accessWith or accessThreadSafeWith with a save functor)
+	// readShared(key): read of shared cache
+	// version is read before shared cache so that a write completing after this point leaves an outdated version on the copy
+	// a copy with an outdated version is overwritten by a new read of shared cache
+	template<typename CacheValue, typename CacheKey, typename AccessPrivate, typename ReadShared>
+	inline
+	CacheValue read(const CacheKey & key, const AccessPrivate & accessPrivate, const ReadShared & readShared) const
+	{
+		const uint64_t current = version(key);
+		const auto load = [&](const CacheKey & missKey){ return VersionedValue<CacheValue>{readShared(missKey),current}; };
+		const VersionedValue<CacheValue> copy = accessPrivate(key,nullptr,0,load);
+		if(copy.version == current)
+			return copy.value;
+
+		const VersionedValue<CacheValue> fresh{readShared(key),current};
+		accessPrivate(key,&fresh,1,VersionedCopy<CacheKey,CacheValue>::noLoad);
+		return fresh.value;
+	}
+
+	// lock statistics of writers, see LockProfiler.h
+	void enableLockProfiler()
+	{
+		writeLocks.enableProfiler();
+	}
+
+	const LockProfiler & getLockProfiler() const
+	{
+		return writeLocks.getProfiler();
+	}
+private:
+	size_t entryM1;
+	std::unique_ptr<std::atomic<uint64_t>[]> versions;
+	StripedLockTable writeLocks;
+};
+
+
+#endif /* COHERENCEDIRECTORY_H_ */
@@ -0,0 +1,101 @@
+/*
+ * CoherentCacheThreader.h
+ *
+ *  Created on: Nov 15, 2021
+ *      Author: tugrul
+ */
+
+#ifndef COHERENTCACHETHREADER_H_
+#define COHERENTCACHETHREADER_H_
+
+#include<memory>
+#include<cstdint>
+#include"DirectMappedCache.h"
+#include"CoherenceDirectory.h"
+#include"../LruClockCache.h"
+
+/* read-write coherent version of CacheThreader: each thread has its own CoherentCacheThreader, all of them share 1 LLC and 1 CoherenceDirectory
+ * L1: direct mapped cache, for each thread
+ * L2: LRU clock cache, for each thread (size must be integer-power of 2)
+ * LLC: user-defined cache with thread-safe get/set methods that is slower but global
+ * set: written through to LLC (locked) and then version of key in directory is increased, which invalidates copies of key in other threads
+ * get: a private (L1/L2) copy is used only if its version is still current (unlocked hit + 1 atomic load)
+ * 		a stale copy is re-read from LLC
+ * every write of LLC has to go through a CoherentCacheThreader (or directory->write()) so that private copies see it
+ * a get that runs concurrently with a set of same key returns either old or new value, a get that starts after the set has returned gets new value
+ */
+template<template<typename,typename, typename> class Cache,typename CacheKey, typename CacheValue, typename CacheInternalCounterTypeInteger=size_t>
+class CoherentCacheThreader
+{
+private:
+	using VersionedValue = ::VersionedValue<CacheValue>;
+	using Copy = VersionedCopy<CacheKey,CacheValue>;
+
+	// last level cache, slow because of lock-guard
+	std::shared_ptr<Cache<CacheKey,CacheValue,CacheInternalCounterTypeInteger>> LLC;
+	std::shared_ptr<CoherenceDirectory> directory;
+	std::shared_ptr<LruClockCache<CacheKey,VersionedValue,CacheInternalCounterTypeInteger>> L2;
+	std::shared_ptr<DirectMappedCache<CacheKey,VersionedValue>> L1;
+
+public:
+	// cacheLLC, coherenceDirectory: same instances for all threads
+	CoherentCacheThreader(std::shared_ptr<Cache<CacheKey,CacheValue,CacheInternalCounterTypeInteger>> cacheLLC, std::shared_ptr<CoherenceDirectory> coherenceDirectory,
+			int sizeCacheL1, int sizeCacheL2)
+	{
+		LLC=cacheLLC;
+		directory=coherenceDirectory;
+
+		// private levels are never dirty against LLC (write-through), L2 drops evicted copies
+		L2=std::make_shared<LruClockCache<CacheKey,VersionedValue,CacheInternalCounterTypeInteger>>(sizeCacheL2,[this](CacheKey key){
+			const uint64_t version = this->directory->version(key);
+			return VersionedValue{this->LLC->getThreadSafe(key),version};
+		},[](CacheKey, VersionedValue){ });
+
+		// L1 writes its evicted copies (that were updated by set) to L2
+		L1=std::make_shared<DirectMappedCache<CacheKey,VersionedValue>>(sizeCacheL1,[this](CacheKey key){
+			return this->L2->get(key);
+		},[this](CacheKey key, VersionedValue value){
+			this->L2->set(key,value);
+		});
+	}
+
+	// get data from closest cache that has a current copy
+	inline
+	const CacheValue get(CacheKey key) const
+	{
+		// L1 miss reads L2, L2 miss reads LLC
+		// stale copy (L1 or L2): overwritten in L1, L2 copy is updated when L1 evicts it
+		return directory->template read<CacheValue>(key,[&](const CacheKey & k, const VersionedValue * v, const bool opType, const auto & loadLLC){
+			const auto loadL2 = [&](const CacheKey & missKey){ return L2->accessWith(missKey,nullptr,0,loadLLC,Copy::dropEvicted); };
+			return L1->accessWith(k,v,opType,loadL2,saveToL2());
+		},[&](const CacheKey & k){ return LLC->getThreadSafe(k); });
+	}
+
+	// set data to LLC and to closest cache, invalidates copies of other threads
+	inline
+	void set(CacheKey key, CacheValue value) const
+	{
+		const uint64_t version = directory->write(key,[&](){ LLC->setThreadSafe(key,value); });
+		const VersionedValue copy{value,version};
+		L1->accessWith(key,&copy,1,Copy::noLoad,saveToL2());
+	}
+
+	// private levels are write-through, LLC already has all data of this thread
+	// kept for compatibility with CacheThreader
+	// LLC needs to be flushed manually by main-thread
+	void flush()
+	{
+
+	}
+
+	~CoherentCacheThreader(){  }
+private:
+	inline
+	auto saveToL2() const
+	{
+		return [this](const CacheKey & evictedKey, const VersionedValue & evicted){ L2->accessWith(evictedKey,&evicted,1,Copy::noLoad,Copy::dropEvicted); };
+	}
+};
+
+
+#endif /* COHERENTCACHETHREADER_H_ */
@@ -0,0 +1,327 @@
+/*
+ * ConstantMappedMultiThreadCache.h
+ *
+ *  Created on: Nov 6, 2021
+ *      Author: tugrul
+ */
+
+#ifndef CONSTANTMAPPEDMULTITHREADCACHE_H_
+#define CONSTANTMAPPEDMULTITHREADCACHE_H_
+
+#include<vector>
+#include<array>
+#include<memory>
+#include<utility>
+#include<functional>
+#include<mutex>
+#include<iostream>
+#include"CacheKeyND.h"
+#include"StripedLockTable.h"
+#include"ParallelFor.h"
+#include"../CacheWritePolicy.h"
+
+
+/* 1D/2D/3D/... Direct-mapped constant-sized cache implementation with granular locking (per-tag)
+ * same idea as UltraMapped2DMultiThreadCache (zero computation for tag search) but for any power-of-2 shape given at compile-time:
+ *		all sizes, masks and shifts are constexpr, buffers are std::array so there are no runtime size fields
+ *		tag of each dimension = key & (Dim-1), slot = tags packed with constant shifts (row-major like C++ arrays)
+ *		ConstantMappedMultiThreadCache<int,int,256,256> is the same mapping as UltraMapped2DMultiThreadCache<int,int>
+ *       Only usable for integer type keys in range [0,maxPositive-1]  (if key is int then "-1" not usable, if key is uint16_t then "65535" not usable)
+ *       since locking protects only items/keys, also the user should make cache-miss functions thread-safe (i.e. adding a lock-guard)
+ *       unless backing-store is thread-safe already (or has multi-thread support already)
+ * CacheKey: type of key (only integers: int, char, size_t)
+ * CacheValue: type of value that is bound to key (same as above)
+ * Dims: number of cache slots/lanes per dimension, each has to be integer-power of 2 (e.g. 2,4,8,16,...)
+ * 		number of dimensions = number of keys given to get/set and to cache-miss functions
+ */
+template<	typename CacheKey, typename CacheValue, size_t ... Dims>
+class ConstantMappedMultiThreadCache
+{
+	static constexpr size_t numDimensions = sizeof...(Dims);
+	static constexpr size_t numSlots = (Dims * ...);
+	static constexpr size_t dimension[numDimensions] = {Dims...};
+
+	static constexpr size_t log2(const size_t n) { return n<=1 ? 0 : 1 + log2(n/2); }
+	static constexpr bool isPowerOf2(const size_t n) { return n>0 && ((n&(n-1))==0); }
+
+	// row-major packing: last dimension is the fastest changing one
+	static constexpr std::array<size_t,numDimensions> computeShifts()
+	{
+		std::array<size_t,numDimensions> result{};
+		size_t shift = 0;
+		for(size_t i=numDimensions;i>0;i--)
+		{
+			result[i-1]=shift;
+			shift += log2(dimension[i-1]);
+		}
+		return result;
+	}
+	static constexpr std::array<size_t,numDimensions> shift = computeShifts();
+
+	static_assert(numDimensions>0,"at least 1 dimension required");
+	static_assert((isPowerOf2(Dims) && ...),"each dimension has to be integer-power of 2");
+	using CacheKeyNDType = CacheKeyND<CacheKey,numDimensions>;
+public:
+	// allocates buffers for Dims... number of cache slots/lanes
+	// readMiss: 	cache-miss for read operations. User needs to give this function
+	// 				to let the cache automatically get data from backing-store
+	//				example: [&](MyClass keyX, MyClass keyY){ return backingStore.get(keyX,keyY); }
+	//				takes 1 CacheKey per dimension, returns CacheValue as value
+	// writeMiss: 	cache-miss for write operations. User needs to give this function
+	// 				to let the cache automatically set data to backing-store
+	//				example: [&](MyClass keyX, MyClass keyY, MyAnotherClass value){ backingStore.set(keyX,keyY,value); }
+	//				takes 1 CacheKey per dimension and CacheValue as value
+	// prepareForMultithreading: by default (true) it allocates a striped lock table (see StripedLockTable.h) for getThreadSafe/setThreadSafe calls
+	//          with a given "false" value, it does not allocate lock table and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
+	// numLockStripes: number of mutexes (64 bytes each) shared by all tags, 0 = min(number of slots, 4096)
+	//          more stripes = less lock contention, fewer stripes = less memory
+	ConstantMappedMultiThreadCache(
+				const std::function<CacheValue(RepeatForDimension<CacheKey,Dims>...)> & readMiss,
+				const std::function<void(RepeatForDimension<CacheKey,Dims>...,CacheValue)> & writeMiss,
+				const bool prepareForMultithreading = true,
+				const size_t numLockStripes = 0):buffer(std::make_unique<Buffer>()),loadData(readMiss),saveData(writeMiss),writePolicy(CacheWritePolicy::WRITE_BACK)
+	{
+		if(prepareForMultithreading)
+			mut = StripedLockTable(numSlots,numLockStripes);
+		// initialize buffers
+		for(size_t i=0;i<numSlots;i++)
+		{
+			buffer->valueBuffer[i]=CacheValue();
+			buffer->isEditedBuffer[i]=0;
+			buffer->keyBuffer[i]=CacheKeyNDType();
+		}
+	}
+
+
+
+	// get element from cache, row-major like C++ multi-dimensional arrays
+	// if cache doesn't find it in buffers,
+	// then cache gets data from backing-store
+	// then returns the result to user
+	// then cache is available from RAM on next get/set access with same key
+	inline
+	const CacheValue get(const RepeatForDimension<CacheKey,Dims> & ... keys)  noexcept
+	{
+		return accessDirect(CacheKeyNDType(keys...),nullptr);
+	}
+
+
+	// thread-safe but slower version of get()
+	inline
+	const CacheValue getThreadSafe(const RepeatForDimension<CacheKey,Dims> & ... keys)  noexcept
+	{
+		return accessDirectLocked(CacheKeyNDType(keys...),nullptr);
+	}
+
+	// set element to cache, row-major like C++ multi-dimensional arrays
+	// if cache doesn't find it in buffers,
+	// then cache sets data on just cache
+	// writing to backing-store only happens when
+	// 					another access evicts the cache slot containing this key/value
+	//					or when cache is flushed by flush() method
+	// then returns the given value back
+	// then cache is available from RAM on next get/set access with same key
+	inline
+	void set(const RepeatForDimension<CacheKey,Dims> & ... keys, const CacheValue & val) noexcept
+	{
+		accessDirect(CacheKeyNDType(keys...),&val,1);
+	}
+
+	// thread-safe but slower version of set()
+	inline
+	void setThreadSafe(const RepeatForDimension<CacheKey,Dims> & ... keys, const CacheValue & val)  noexcept
+	{
+		accessDirectLocked(CacheKeyNDType(keys...),&val,1);
+	}
+
+	// use this before closing the backing-store to store the latest bits of data
+	// parallelism: number of threads that write edited slots back in parallel (each takes a range of slots)
+	//				1 = calling thread only, 0 = std::thread::hardware_concurrency()
+	//				helper threads are started and joined by each call (see parallelFor in ParallelFor.h)
+	//				writeMiss is called from multiple threads when parallelism != 1
+	void flush(const int parallelism = 1)
+	{
+		try
+		{
+			parallelForChunks(numSlots,parallelism,[&](const size_t begin, const size_t end){
+				if(mut.size()>0)
+				{
+					for (size_t i=begin;i<end;i++)
+					{
+						std::lock_guard<std::mutex> lg(mut.of(i));
+						if (buffer->isEditedBuffer[i] == 1)
+						{
+							buffer->isEditedBuffer[i]=0;
+							auto oldKey = buffer->keyBuffer[i];
+							auto oldValue = buffer->valueBuffer[i];
+							save(oldKey,oldValue,std::make_index_sequence<numDimensions>());
+						}
+					}
+				}
+				else
+				{
+					for (size_t i=begin;i<end;i++)
+					{
+						if (buffer->isEditedBuffer[i] == 1)
+						{
+							buffer->isEditedBuffer[i]=0;
+							auto oldKey = buffer->keyBuffer[i];
+							auto oldValue = buffer->valueBuffer[i];
+							save(oldKey,oldValue,std::make_index_sequence<numDimensions>());
+						}
+					}
+				}
+			});
+		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
+	}
+
+	// selects how "set" reaches backing-store (see CacheWritePolicy.h), default is WRITE_BACK
+	// 		WRITE_THROUGH: every set calls writeMiss, slots are never edited (flush has nothing to write)
+	// 		WRITE_AROUND: set of a key that is not cached calls writeMiss without evicting a slot
+	// call before using the cache (not thread-safe)
+	void enableWritePolicy(const CacheWritePolicy policy)
+	{
+		writePolicy = policy;
+	}
+
+	// direct mapped cache element access, locked per item for parallelism
+	// opType=0: get
+	// opType=1: set
+	CacheValue const accessDirectLocked(const CacheKeyNDType & key,const CacheValue * value, const bool opType = 0)
+	{
+		const size_t index = slotOf(key,std::make_index_sequence<numDimensions>());
+		std::lock_guard<std::mutex> lg(mut.of(index)); // N parallel locks in-flight = less contention in multi-threading
+		return accessSlot(index,key,value,opType);
+	}
+
+	// direct mapped cache element access
+	// opType=0: get
+	// opType=1: set
+	CacheValue const accessDirect(const CacheKeyNDType & key,const CacheValue * value, const bool opType = 0)
+	{
+		const size_t index = slotOf(key,std::make_index_sequence<numDimensions>());
+		return accessSlot(index,key,value,opType);
+	}
+
+private:
+	// all masks and shifts are compile-time constants, no multiplication
+	template<size_t ... I>
+	static inline size_t slotOf(const CacheKeyNDType & key, std::index_sequence<I...>) noexcept
+	{
+		return ( ( ((size_t)key.k[I] & (dimension[I]-1)) << shift[I] ) | ... );
+	}
+
+	template<size_t ... I>
+	inline CacheValue load(const CacheKeyNDType & key, std::index_sequence<I...>)
+	{
+		return loadData(key.k[I]...);
+	}
+
+	template<size_t ... I>
+	inline void save(const CacheKeyNDType & key, const CacheValue & value, std::index_sequence<I...>)
+	{
+		saveData(key.k[I]...,value);
+	}
+
+	inline
+	CacheValue const accessSlot(const size_t index, const CacheKeyNDType & key,const CacheValue * value, const bool opType)
+	{
+		auto & valueBuffer = buffer->valueBuffer;
+		auto & isEditedBuffer = buffer->isEditedBuffer;
+		auto & keyBuffer = buffer->keyBuffer;
+
+		// compare keys
+		const CacheKeyNDType oldKey = keyBuffer[index];
+		if(oldKey == key)
+		{
+			// cache-hit
+
+			// "set"
+			if(opType == 1)
+			{
+				isEditedBuffer[index]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
+				valueBuffer[index]=*value;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					save(key,*value,std::make_index_sequence<numDimensions>());
+			}
+
+			// cache hit value
+			return valueBuffer[index];
+		}
+		else if(opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND)
+		{
+			// bypass: slot keeps its item
+			save(key,*value,std::make_index_sequence<numDimensions>());
+			return *value;
+		}
+		else // cache-miss
+		{
+			CacheValue oldValue = valueBuffer[index];
+
+			// eviction algorithm start
+			if(isEditedBuffer[index] == 1)
+			{
+				// if it is "get"
+				if(opType==0)
+				{
+					isEditedBuffer[index]=0;
+				}
+
+				save(oldKey,oldValue,std::make_index_sequence<numDimensions>());
+			}
+			else if(opType == 1) // "set" on not edited
+			{
+				isEditedBuffer[index]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
+			}
+
+			// "get"
+			if(opType==0)
+			{
+				const CacheValue && loadedData = load(key,std::make_index_sequence<numDimensions>());
+				valueBuffer[index]=loadedData;
+				keyBuffer[index]=key;
+				return loadedData;
+			}
+			else /* "set" */
+			{
+				valueBuffer[index]=*value;
+				keyBuffer[index]=key;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+				{
+					isEditedBuffer[index]=0;
+					save(key,*value,std::make_index_sequence<numDimensions>());
+				}
+				return *value;
+			}
+		}
+	}
+
+	struct Buffer
+	{
+		std::array<CacheValue,numSlots> valueBuffer;
+		std::array<unsigned char,numSlots> isEditedBuffer;
+		std::array<CacheKeyNDType,numSlots> keyBuffer;
+	};
+
+	StripedLockTable mut;
+	std::unique_ptr<Buffer> buffer;
+
+	const std::function<CacheValue(RepeatForDimension<CacheKey,Dims>...)>  loadData;
+	const std::function<void(RepeatForDimension<CacheKey,Dims>...,CacheValue)>  saveData;
+	CacheWritePolicy writePolicy;
+};
+
+// compile-time sized equivalent of DirectMappedCache
+template<typename CacheKey, typename CacheValue, size_t Size>
+using ConstantMappedCache = ConstantMappedMultiThreadCache<CacheKey,CacheValue,Size>;
+
+// compile-time sized equivalent of DirectMapped2DMultiThreadCache
+template<typename CacheKey, typename CacheValue, size_t SizeX, size_t SizeY>
+using ConstantMapped2DMultiThreadCache = ConstantMappedMultiThreadCache<CacheKey,CacheValue,SizeX,SizeY>;
+
+// compile-time sized equivalent of DirectMapped3DMultiThreadCache
+template<typename CacheKey, typename CacheValue, size_t SizeX, size_t SizeY, size_t SizeZ>
+using ConstantMapped3DMultiThreadCache = ConstantMappedMultiThreadCache<CacheKey,CacheValue,SizeX,SizeY,SizeZ>;
+
+
+#endif /* CONSTANTMAPPEDMULTITHREADCACHE_H_ */
@@ -8,13 +8,12 @@
 #ifndef DIRECTMAPPED2DMULTITHREADCACHE_H_
 #define DIRECTMAPPED2DMULTITHREADCACHE_H_
 
-
-#include<vector>
 #include<functional>
-#include<mutex>
+#include"DirectMappedNDCache.h"
 
 
 /* 2D Direct-mapped cache implementation with granular locking (per-tag)
+ * (N=2 version of DirectMappedNDCache)
  *       Only usable for integer type keys in range [0,maxPositive-1] (if key is int then "-1" not usable, if key is uint16_t then "65535" not usable)
  *       since locking protects only items/keys, also the user should make cache-miss functions thread-safe (i.e. adding a lock-guard)
  *       unless backing-store is thread-safe already (or has multi-thread support already)
@@ -23,10 +22,10 @@
  * Can be used alone, as a read+write multi-threaded cache using getThreadSafe setThreadSafe methods but cache-hit ratio will not be good
  * CacheKey: type of key (only integers: int, char, size_t, uint16_t, ...)
  * CacheValue: type of value that is bound to key (same as above)
- * InternalKeyTypeInteger: type of tag found after modulo operationa (is important for maximum cache size. unsigned char = 255, unsigned int=1024*1024*1024*4)
+ * InternalKeyTypeInteger: ignored (tags are computed by DirectMappedNDCache), kept only for source compatibility
  */
 template<	typename CacheKey, typename CacheValue, typename InternalKeyTypeInteger=size_t>
-class DirectMapped2DMultiThreadCache
+class DirectMapped2DMultiThreadCache : public DirectMappedNDCache<CacheKey,CacheValue,2>
 {
 public:
 	// allocates buffers for numElementsX x numElementsY number of cache slots/lanes
@@ -40,33 +39,34 @@ public:
 	//				takes a CacheKey as key and CacheValue as value
 	// numElementsX: has to be integer-power of 2 (e.g. 2,4,8,16,...)
 	// numElementsY: has to be integer-power of 2 (e.g. 2,4,8,16,...)
-	// prepareForMultithreading: by default (true) it allocates an array of structs each with its own mutex to evade false-sharing during getThreadSafe/setThreadSafe calls
-	//          with a given "false" value, it does not allocate mutex array and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
-	//          true: allocates at least extra 256 bytes per cache tag
+	// prepareForMultithreading: by default (true) it allocates a striped lock table (see StripedLockTable.h) for getThreadSafe/setThreadSafe calls
+	//          with a given "false" value, it does not allocate lock table and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
+	// numLockStripes: number of mutexes (64 bytes each) shared by all tags (tiles, in tiled mode), 0 = min(number of tags, 4096)
+	//          more stripes = less lock contention, fewer stripes = less memory
+	// zOrderLayout: (optional) true = slots are placed in Morton (Z) order instead of row-major so that neighbor keys share cache lines
 	DirectMapped2DMultiThreadCache(CacheKey numElementsX,CacheKey numElementsY,
 				const std::function<CacheValue(CacheKey,CacheKey)> & readMiss,
 				const std::function<void(CacheKey,CacheKey,CacheValue)> & writeMiss,
-				const bool prepareForMultithreading = true):sizeX(numElementsX),sizeY(numElementsY),sizeXM1(numElementsX-1),sizeYM1(numElementsY-1),loadData(readMiss),saveData(writeMiss)
+				const bool prepareForMultithreading = true,
+				const bool zOrderLayout = false,
+				const size_t numLockStripes = 0):DirectMappedNDCache<CacheKey,CacheValue,2>({numElementsX,numElementsY},readMiss,writeMiss,prepareForMultithreading,zOrderLayout,numLockStripes)
+	{
+
+	}
+
+	// tiled version (see DirectMappedNDCache): a cache-miss loads a whole tile (8x8 for example) with 1 readMissTile call
+	//		and an eviction of an edited tile writes the whole tile with 1 writeMissTile call
+	// readMissTile: 	[&](MyClass x0, MyClass y0, MyAnotherClass * tile){ ... tile[(x-x0)*tileElementsY + (y-y0)] = backingStore.get(x,y); ... }
+	// writeMissTile: 	[&](MyClass x0, MyClass y0, const MyAnotherClass * tile){ ... }
+	// tileElementsX/Y: has to be integer-power of 2, not greater than numElements of same dimension
+	DirectMapped2DMultiThreadCache(CacheKey numElementsX,CacheKey numElementsY,CacheKey tileElementsX,CacheKey tileElementsY,
+				const std::function<void(CacheKey,CacheKey,CacheValue *)> & readMissTile,
+				const std::function<void(CacheKey,CacheKey,const CacheValue *)> & writeMissTile,
+				const bool prepareForMultithreading = true,
+				const bool zOrderLayout = false,
+				const size_t numLockStripes = 0):DirectMappedNDCache<CacheKey,CacheValue,2>({numElementsX,numElementsY},{tileElementsX,tileElementsY},readMissTile,writeMissTile,prepareForMultithreading,zOrderLayout,numLockStripes)
 	{
-		if(prepareForMultithreading)
-			mut = std::vector<MutexWithoutFalseSharing>(numElementsX*numElementsY);
-		// initialize buffers
-		valueBuffer.reserve(numElementsX*numElementsY);
-		isEditedBuffer.reserve(numElementsX*numElementsY);
-		keyBuffer.reserve(numElementsX*numElementsY);
-		for(size_t i=0;i<numElementsX;i++)
-		{
-			for(size_t j=0;j<numElementsY;j++)
-			{
-				valueBuffer.push_back(CacheValue());
-				isEditedBuffer.push_back(0);
-				CacheKey2D key2D;
-				key2D.x=CacheKey()-1;
-				key2D.y=CacheKey()-1;
 
-				keyBuffer.push_back(key2D);
-			}
-		}
 	}
 
 
@@ -111,241 +111,64 @@ public:
 		accessDirectLocked(keyX,keyY,&val,1);
 	}
 
-	// use this before closing the backing-store to store the latest bits of data
-	void flush()
+	// stencil gather: out[p] = get(center + pattern[p]) for each point of pattern in one pass
+	// pattern example (5-point): {{0,0},{-1,0},{1,0},{0,-1},{0,1}}
+	inline
+	void getStencil(const CacheKey & keyX,const CacheKey & keyY, const std::vector<std::array<int,2>> & pattern, CacheValue * out)  noexcept
 	{
-		try
-		{
-			const size_t n = sizeX*sizeY;
-			if(mut.size()>0)
-			{
-				for (size_t i=0;i<n;i++)
-				{
-					std::lock_guard<std::mutex> lg(mut[i].mut);
-					if (isEditedBuffer[i] == 1)
-					{
-						isEditedBuffer[i]=0;
-						auto oldKey = keyBuffer[i];
-						auto oldValue = valueBuffer[i];
-						saveData(oldKey.x,oldKey.y,oldValue);
-					}
-				}
-			}
-			else
-			{
-				for (size_t i=0;i<n;i++)
-				{
-					if (isEditedBuffer[i] == 1)
-					{
-						isEditedBuffer[i]=0;
-						auto oldKey = keyBuffer[i];
-						auto oldValue = valueBuffer[i];
-						saveData(oldKey.x,oldKey.y,oldValue);
-					}
-				}
-			}
-		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
+		DirectMappedNDCache<CacheKey,CacheValue,2>::getStencil(CacheKeyND<CacheKey,2>(keyX,keyY),pattern,out);
 	}
 
-	// direct mapped cache element access, locked per item for parallelism
-	// opType=0: get
-	// opType=1: set
-	CacheValue const accessDirectLocked(const CacheKey & keyX, const CacheKey & keyY,const CacheValue * value, const bool opType = 0)
+	// thread-safe but slower version of getStencil(), each needed lock is taken once per call
+	inline
+	void getStencilThreadSafe(const CacheKey & keyX,const CacheKey & keyY, const std::vector<std::array<int,2>> & pattern, CacheValue * out)  noexcept
 	{
+		DirectMappedNDCache<CacheKey,CacheValue,2>::getStencilThreadSafe(CacheKeyND<CacheKey,2>(keyX,keyY),pattern,out);
+	}
 
-		// find tag mapped to the key
-		CacheKey tagX = keyX & sizeXM1;
-		CacheKey tagY = keyY & sizeYM1;
-		const size_t index = tagX*(size_t)sizeY+tagY;
-		std::lock_guard<std::mutex> lg(mut[index].mut); // N parallel locks in-flight = less contention in multi-threading
-
-		// compare keys
-		const auto oldKey2D = keyBuffer[index];
-		const auto newKey2D = CacheKey2D(keyX,keyY);
-		if(oldKey2D.x == keyX && oldKey2D.y == keyY)
-		{
-			// cache-hit
-
-			// "set"
-			if(opType == 1)
-			{
-				isEditedBuffer[index]=1;
-				valueBuffer[index]=*value;
-			}
-
-			// cache hit value
-			return valueBuffer[index];
-		}
-		else // cache-miss
-		{
-			CacheValue oldValue = valueBuffer[index];
-
-			// eviction algorithm start
-			if(isEditedBuffer[index] == 1)
-			{
-				// if it is "get"
-				if(opType==0)
-				{
-					isEditedBuffer[index]=0;
-				}
-
-				saveData(oldKey2D.x,oldKey2D.y,oldValue);
+	// row gather: out[i] = get(keyX0+i, keyY) for i in [0,n)
+	inline
+	void getRowSpan(const CacheKey & keyY, const CacheKey & keyX0, const size_t n, CacheValue * out)  noexcept
+	{
+		DirectMappedNDCache<CacheKey,CacheValue,2>::getSpan(CacheKeyND<CacheKey,2>(keyX0,keyY),0,n,out);
+	}
 
-				// "get"
-				if(opType==0)
-				{
-					const CacheValue && loadedData = loadData(newKey2D.x,newKey2D.y);
-					valueBuffer[index]=loadedData;
-					keyBuffer[index]=newKey2D;
-					return loadedData;
-				}
-				else /* "set" */
-				{
-					valueBuffer[index]=*value;
-					keyBuffer[index]=newKey2D;
-					return *value;
-				}
-			}
-			else // not edited
-			{
-				// "set"
-				if(opType == 1)
-				{
-					isEditedBuffer[index]=1;
-				}
+	// thread-safe but slower version of getRowSpan(), each needed lock is taken once per call
+	inline
+	void getRowSpanThreadSafe(const CacheKey & keyY, const CacheKey & keyX0, const size_t n, CacheValue * out)  noexcept
+	{
+		DirectMappedNDCache<CacheKey,CacheValue,2>::getSpanThreadSafe(CacheKeyND<CacheKey,2>(keyX0,keyY),0,n,out);
+	}
 
-				// "get"
-				if(opType == 0)
-				{
-					const CacheValue && loadedData = loadData(newKey2D.x,newKey2D.y);
-					valueBuffer[index]=loadedData;
-					keyBuffer[index]=newKey2D;
-					return loadedData;
-				}
-				else // "set"
-				{
-					valueBuffer[index]=*value;
-					keyBuffer[index]=newKey2D;
-					return *value;
-				}
-			}
+	// row scatter: set(keyX0+i, keyY, in[i]) for i in [0,n)
+	inline
+	void setRowSpan(const CacheKey & keyY, const CacheKey & keyX0, const size_t n, const CacheValue * in)  noexcept
+	{
+		DirectMappedNDCache<CacheKey,CacheValue,2>::setSpan(CacheKeyND<CacheKey,2>(keyX0,keyY),0,n,in);
+	}
 
-		}
+	// thread-safe but slower version of setRowSpan(), each needed lock is taken once per call
+	inline
+	void setRowSpanThreadSafe(const CacheKey & keyY, const CacheKey & keyX0, const size_t n, const CacheValue * in)  noexcept
+	{
+		DirectMappedNDCache<CacheKey,CacheValue,2>::setSpanThreadSafe(CacheKeyND<CacheKey,2>(keyX0,keyY),0,n,in);
 	}
 
-	// direct mapped cache element access
+	// direct mapped cache element access, locked per item for parallelism
 	// opType=0: get
 	// opType=1: set
-	CacheValue const accessDirect(const CacheKey & keyX, const CacheKey & keyY,const CacheValue * value, const bool opType = 0)
+	CacheValue const accessDirectLocked(const CacheKey & keyX,const CacheKey & keyY,const CacheValue * value, const bool opType = 0)
 	{
-
-		// find tag mapped to the key
-		CacheKey tagX = keyX & sizeXM1;
-		CacheKey tagY = keyY & sizeYM1;
-
-		const size_t index = tagX*(size_t)sizeY+tagY;
-
-		// compare keys
-		const auto oldKey2D = keyBuffer[index];
-		const auto newKey2D = CacheKey2D(keyX,keyY);
-		if(oldKey2D.x == keyX && oldKey2D.y == keyY)
-		{
-			// cache-hit
-
-			// "set"
-			if(opType == 1)
-			{
-				isEditedBuffer[index]=1;
-				valueBuffer[index]=*value;
-			}
-
-			// cache hit value
-			return valueBuffer[index];
-		}
-		else // cache-miss
-		{
-			CacheValue oldValue = valueBuffer[index];
-
-			// eviction algorithm start
-			if(isEditedBuffer[index] == 1)
-			{
-				// if it is "get"
-				if(opType==0)
-				{
-					isEditedBuffer[index]=0;
-				}
-
-				saveData(oldKey2D.x,oldKey2D.y,oldValue);
-
-				// "get"
-				if(opType==0)
-				{
-					const CacheValue && loadedData = loadData(newKey2D.x,newKey2D.y);
-					valueBuffer[index]=loadedData;
-					keyBuffer[index]=newKey2D;
-					return loadedData;
-				}
-				else /* "set" */
-				{
-					valueBuffer[index]=*value;
-					keyBuffer[index]=newKey2D;
-					return *value;
-				}
-			}
-			else // not edited
-			{
-				// "set"
-				if(opType == 1)
-				{
-					isEditedBuffer[index]=1;
-				}
-
-				// "get"
-				if(opType == 0)
-				{
-					const CacheValue && loadedData = loadData(newKey2D.x,newKey2D.y);
-					valueBuffer[index]=loadedData;
-					keyBuffer[index]=newKey2D;
-					return loadedData;
-				}
-				else // "set"
-				{
-					valueBuffer[index]=*value;
-					keyBuffer[index]=newKey2D;
-					return *value;
-				}
-			}
-
-		}
+		return DirectMappedNDCache<CacheKey,CacheValue,2>::accessDirectLocked(CacheKeyND<CacheKey,2>(keyX,keyY),value,opType);
 	}
 
-
-
-private:
-	struct CacheKey2D
-	{
-		CacheKey2D():x(CacheKey()-1),y(CacheKey()-1) { }
-		CacheKey2D(CacheKey xPrm, CacheKey yPrm):x(xPrm),y(yPrm) { }
-		CacheKey x,y;
-	};
-	struct MutexWithoutFalseSharing
+	// direct mapped cache element access
+	// opType=0: get
+	// opType=1: set
+	CacheValue const accessDirect(const CacheKey & keyX,const CacheKey & keyY,const CacheValue * value, const bool opType = 0)
 	{
-		std::mutex mut;
-		char padding[256-sizeof(std::mutex) <= 0 ? 4:256-sizeof(std::mutex)];
-	};
-	const CacheKey sizeX;
-	const CacheKey sizeY;
-	const CacheKey sizeXM1;
-	const CacheKey sizeYM1;
-
-	std::vector<MutexWithoutFalseSharing> mut;
-	std::vector<CacheValue> valueBuffer;
-	std::vector<unsigned char> isEditedBuffer;
-	std::vector<CacheKey2D> keyBuffer;
-
-	const std::function<CacheValue(CacheKey,CacheKey)>  loadData;
-	const std::function<void(CacheKey,CacheKey,CacheValue)>  saveData;
-
+		return DirectMappedNDCache<CacheKey,CacheValue,2>::accessDirect(CacheKeyND<CacheKey,2>(keyX,keyY),value,opType);
+	}
 };
 
 
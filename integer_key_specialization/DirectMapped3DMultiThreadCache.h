@@ -9,13 +9,12 @@
 #define DIRECTMAPPED3DMULTITHREADCACHE_H_
 
 
-
-#include<vector>
 #include<functional>
-#include<mutex>
+#include"DirectMappedNDCache.h"
 
 
 /* 3D Direct-mapped cache implementation with granular locking (per-tag)
+ * (N=3 version of DirectMappedNDCache)
  *       Only usable for integer type keys in range [0,maxPositive-1] (if key is int then "-1" not usable, if key is uint16_t then "65535" not usable)
  *       since locking protects only items/keys, also the user should make cache-miss functions thread-safe (i.e. adding a lock-guard)
  *       unless backing-store is thread-safe already (or has multi-thread support already)
@@ -24,10 +23,10 @@
  * Can be used alone, as a read+write multi-threaded cache using getThreadSafe setThreadSafe methods but cache-hit ratio will not be good
  * CacheKey: type of key (only integers: int, char, size_t, uint16_t, ...)
  * CacheValue: type of value that is bound to key (same as above)
- * InternalKeyTypeInteger: type of tag found after modulo operationa (is important for maximum cache size. unsigned char = 255, unsigned int=1024*1024*1024*4)
+ * InternalKeyTypeInteger: ignored (tags are computed by DirectMappedNDCache), kept only for source compatibility
  */
 template<	typename CacheKey, typename CacheValue, typename InternalKeyTypeInteger=size_t>
-class DirectMapped3DMultiThreadCache
+class DirectMapped3DMultiThreadCache : public DirectMappedNDCache<CacheKey,CacheValue,3>
 {
 public:
 	// allocates buffers for numElementsX x numElementsY x numElementsZ number of cache slots/lanes
@@ -42,36 +41,34 @@ public:
 	// numElementsX: has to be integer-power of 2 (e.g. 2,4,8,16,...)
 	// numElementsY: has to be integer-power of 2 (e.g. 2,4,8,16,...)
 	// numElementsZ: has to be integer-power of 2 (e.g. 2,4,8,16,...)
-	// prepareForMultithreading: by default (true) it allocates an array of structs each with its own mutex to evade false-sharing during getThreadSafe/setThreadSafe calls
-	//          with a given "false" value, it does not allocate mutex array and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
-	//          true: allocates at least extra 256 bytes per cache tag
+	// prepareForMultithreading: by default (true) it allocates a striped lock table (see StripedLockTable.h) for getThreadSafe/setThreadSafe calls
+	//          with a given "false" value, it does not allocate lock table and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
+	// numLockStripes: number of mutexes (64 bytes each) shared by all tags (tiles, in tiled mode), 0 = min(number of tags, 4096)
+	//          more stripes = less lock contention, fewer stripes = less memory
+	// zOrderLayout: (optional) true = slots are placed in Morton (Z) order instead of row-major so that neighbor keys share cache lines
 	DirectMapped3DMultiThreadCache(CacheKey numElementsX,CacheKey numElementsY,CacheKey numElementsZ,
 				const std::function<CacheValue(CacheKey,CacheKey,CacheKey)> & readMiss,
 				const std::function<void(CacheKey,CacheKey,CacheKey,CacheValue)> & writeMiss,
-				const bool prepareForMultithreading = true):sizeX(numElementsX),sizeY(numElementsY),sizeZ(numElementsZ),sizeXM1(numElementsX-1),sizeYM1(numElementsY-1),sizeZM1(numElementsZ-1),loadData(readMiss),saveData(writeMiss)
+				const bool prepareForMultithreading = true,
+				const bool zOrderLayout = false,
+				const size_t numLockStripes = 0):DirectMappedNDCache<CacheKey,CacheValue,3>({numElementsX,numElementsY,numElementsZ},readMiss,writeMiss,prepareForMultithreading,zOrderLayout,numLockStripes)
 	{
-		if(prepareForMultithreading)
-			mut = std::vector<MutexWithoutFalseSharing>(numElementsX*numElementsY*numElementsZ);
-		// initialize buffers
-		valueBuffer.reserve(numElementsX*numElementsY*numElementsZ);
-		isEditedBuffer.reserve(numElementsX*numElementsY*numElementsZ);
-		keyBuffer.reserve(numElementsX*numElementsY*numElementsZ);
-		for(size_t i=0;i<numElementsX;i++)
-		{
-			for(size_t j=0;j<numElementsY;j++)
-			{
-				for(size_t k=0;k<numElementsZ;k++)
-				{
-					valueBuffer.push_back(CacheValue());
-					isEditedBuffer.push_back(0);
-					CacheKey3D key3D;
-					key3D.x=CacheKey()-1;
-					key3D.y=CacheKey()-1;
-					key3D.z=CacheKey()-1;
-					keyBuffer.push_back(key3D);
-				}
-			}
-		}
+
+	}
+
+	// tiled version (see DirectMappedNDCache): a cache-miss loads a whole tile (4x4x4 for example) with 1 readMissTile call
+	//		and an eviction of an edited tile writes the whole tile with 1 writeMissTile call
+	// readMissTile: 	[&](MyClass x0, MyClass y0, MyClass z0, MyAnotherClass * tile){ ... tile[((x-x0)*tileElementsY + (y-y0))*tileElementsZ + (z-z0)] = backingStore.get(x,y,z); ... }
+	// writeMissTile: 	[&](MyClass x0, MyClass y0, MyClass z0, const MyAnotherClass * tile){ ... }
+	// tileElementsX/Y/Z: has to be integer-power of 2, not greater than numElements of same dimension
+	DirectMapped3DMultiThreadCache(CacheKey numElementsX,CacheKey numElementsY,CacheKey numElementsZ,CacheKey tileElementsX,CacheKey tileElementsY,CacheKey tileElementsZ,
+				const std::function<void(CacheKey,CacheKey,CacheKey,CacheValue *)> & readMissTile,
+				const std::function<void(CacheKey,CacheKey,CacheKey,const CacheValue *)> & writeMissTile,
+				const bool prepareForMultithreading = true,
+				const bool zOrderLayout = false,
+				const size_t numLockStripes = 0):DirectMappedNDCache<CacheKey,CacheValue,3>({numElementsX,numElementsY,numElementsZ},{tileElementsX,tileElementsY,tileElementsZ},readMissTile,writeMissTile,prepareForMultithreading,zOrderLayout,numLockStripes)
+	{
+
 	}
 
 
@@ -116,251 +113,67 @@ public:
 		accessDirectLocked(keyX,keyY,keyZ,&val,1);
 	}
 
-	// use this before closing the backing-store to store the latest bits of data
-	void flush()
+	// stencil gather: out[p] = get(center + pattern[p]) for each point of pattern in one pass
+	// pattern example (7-point): {{0,0,0},{-1,0,0},{1,0,0},{0,-1,0},{0,1,0},{0,0,-1},{0,0,1}}
+	inline
+	void getStencil(const CacheKey & keyX,const CacheKey & keyY,const CacheKey & keyZ, const std::vector<std::array<int,3>> & pattern, CacheValue * out)  noexcept
 	{
-		try
-		{
-			const size_t n = sizeX*sizeY*sizeZ;
-			if(mut.size()>0)
-			{
-				for (size_t i=0;i<n;i++)
-				{
-					std::lock_guard<std::mutex> lg(mut[i].mut);
-					if (isEditedBuffer[i] == 1)
-					{
-						isEditedBuffer[i]=0;
-						auto oldKey = keyBuffer[i];
-						auto oldValue = valueBuffer[i];
-						saveData(oldKey.x,oldKey.y,oldKey.z,oldValue);
-					}
-				}
-			}
-			else
-			{
-				for (size_t i=0;i<n;i++)
-				{
-					if (isEditedBuffer[i] == 1)
-					{
-						isEditedBuffer[i]=0;
-						auto oldKey = keyBuffer[i];
-						auto oldValue = valueBuffer[i];
-						saveData(oldKey.x,oldKey.y,oldKey.z,oldValue);
-					}
-				}
-			}
-		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
+		DirectMappedNDCache<CacheKey,CacheValue,3>::getStencil(CacheKeyND<CacheKey,3>(keyX,keyY,keyZ),pattern,out);
 	}
 
-	// direct mapped cache element access, locked per item for parallelism
-	// opType=0: get
-	// opType=1: set
-	CacheValue accessDirectLocked(const CacheKey & keyX, const CacheKey & keyY, const CacheKey & keyZ,const CacheValue * value, const bool opType = 0)
+	// thread-safe but slower version of getStencil(), each needed lock is taken once per call
+	inline
+	void getStencilThreadSafe(const CacheKey & keyX,const CacheKey & keyY,const CacheKey & keyZ, const std::vector<std::array<int,3>> & pattern, CacheValue * out)  noexcept
 	{
+		DirectMappedNDCache<CacheKey,CacheValue,3>::getStencilThreadSafe(CacheKeyND<CacheKey,3>(keyX,keyY,keyZ),pattern,out);
+	}
 
-		// find tag mapped to the key
-		CacheKey tagX = keyX & sizeXM1;
-		CacheKey tagY = keyY & sizeYM1;
-		CacheKey tagZ = keyZ & sizeZM1;
-		const size_t index = tagX*(size_t)sizeY*(size_t)sizeZ+tagY*(size_t)sizeZ + tagZ;
-		std::lock_guard<std::mutex> lg(mut[index].mut); // N parallel locks in-flight = less contention in multi-threading
-
-		// compare keys
-		const auto oldKey3D = keyBuffer[index];
-		const auto newKey3D = CacheKey3D(keyX,keyY,keyZ);
-		if(oldKey3D.x == keyX && oldKey3D.y == keyY && oldKey3D.z == keyZ)
-		{
-			// cache-hit
-
-			// "set"
-			if(opType == 1)
-			{
-				isEditedBuffer[index]=1;
-				valueBuffer[index]=*value;
-			}
-
-			// cache hit value
-			return valueBuffer[index];
-		}
-		else // cache-miss
-		{
-			CacheValue oldValue = valueBuffer[index];
-
-			// eviction algorithm start
-			if(isEditedBuffer[index] == 1)
-			{
-				// if it is "get"
-				if(opType==0)
-				{
-					isEditedBuffer[index]=0;
-				}
-
-				saveData(oldKey3D.x,oldKey3D.y,oldKey3D.z,oldValue);
+	// row gather: out[i] = get(keyX0+i, keyY, keyZ) for i in [0,n)
+	inline
+	void getRowSpan(const CacheKey & keyY,const CacheKey & keyZ, const CacheKey & keyX0, const size_t n, CacheValue * out)  noexcept
+	{
+		DirectMappedNDCache<CacheKey,CacheValue,3>::getSpan(CacheKeyND<CacheKey,3>(keyX0,keyY,keyZ),0,n,out);
+	}
 
-				// "get"
-				if(opType==0)
-				{
-					const CacheValue && loadedData = loadData(newKey3D.x,newKey3D.y,newKey3D.z);
-					valueBuffer[index]=loadedData;
-					keyBuffer[index]=newKey3D;
-					return loadedData;
-				}
-				else /* "set" */
-				{
-					valueBuffer[index]=*value;
-					keyBuffer[index]=newKey3D;
-					return *value;
-				}
-			}
-			else // not edited
-			{
-				// "set"
-				if(opType == 1)
-				{
-					isEditedBuffer[index]=1;
-				}
+	// thread-safe but slower version of getRowSpan(), each needed lock is taken once per call
+	inline
+	void getRowSpanThreadSafe(const CacheKey & keyY,const CacheKey & keyZ, const CacheKey & keyX0, const size_t n, CacheValue * out)  noexcept
+	{
+		DirectMappedNDCache<CacheKey,CacheValue,3>::getSpanThreadSafe(CacheKeyND<CacheKey,3>(keyX0,keyY,keyZ),0,n,out);
+	}
 
-				// "get"
-				if(opType == 0)
-				{
-					const CacheValue && loadedData = loadData(newKey3D.x,newKey3D.y,newKey3D.z);
-					valueBuffer[index]=loadedData;
-					keyBuffer[index]=newKey3D;
-					return loadedData;
-				}
-				else // "set"
-				{
-					valueBuffer[index]=*value;
-					keyBuffer[index]=newKey3D;
-					return *value;
-				}
-			}
+	// row scatter: set(keyX0+i, keyY, keyZ, in[i]) for i in [0,n)
+	inline
+	void setRowSpan(const CacheKey & keyY,const CacheKey & keyZ, const CacheKey & keyX0, const size_t n, const CacheValue * in)  noexcept
+	{
+		DirectMappedNDCache<CacheKey,CacheValue,3>::setSpan(CacheKeyND<CacheKey,3>(keyX0,keyY,keyZ),0,n,in);
+	}
 
-		}
+	// thread-safe but slower version of setRowSpan(), each needed lock is taken once per call
+	inline
+	void setRowSpanThreadSafe(const CacheKey & keyY,const CacheKey & keyZ, const CacheKey & keyX0, const size_t n, const CacheValue * in)  noexcept
+	{
+		DirectMappedNDCache<CacheKey,CacheValue,3>::setSpanThreadSafe(CacheKeyND<CacheKey,3>(keyX0,keyY,keyZ),0,n,in);
 	}
 
-	// direct mapped cache element access
+	// direct mapped cache element access, locked per item for parallelism
 	// opType=0: get
 	// opType=1: set
-	CacheValue accessDirect(const CacheKey & keyX, const CacheKey & keyY, const CacheKey & keyZ, const CacheValue * value, const bool opType = 0)
+	CacheValue const accessDirectLocked(const CacheKey & keyX,const CacheKey & keyY,const CacheKey & keyZ,const CacheValue * value, const bool opType = 0)
 	{
-
-		// find tag mapped to the key
-		CacheKey tagX = keyX & sizeXM1;
-		CacheKey tagY = keyY & sizeYM1;
-		CacheKey tagZ = keyZ & sizeZM1;
-		const size_t index = tagX*(size_t)sizeY*(size_t)sizeZ+tagY*(size_t)sizeZ + tagZ;
-
-
-		// compare keys
-		const auto oldKey3D = keyBuffer[index];
-		const auto newKey3D = CacheKey3D(keyX,keyY,keyZ);
-		if(oldKey3D.x == keyX && oldKey3D.y == keyY && oldKey3D.z == keyZ)
-		{
-			// cache-hit
-
-			// "set"
-			if(opType == 1)
-			{
-				isEditedBuffer[index]=1;
-				valueBuffer[index]=*value;
-			}
-
-			// cache hit value
-			return valueBuffer[index];
-		}
-		else // cache-miss
-		{
-			CacheValue oldValue = valueBuffer[index];
-
-			// eviction algorithm start
-			if(isEditedBuffer[index] == 1)
-			{
-				// if it is "get"
-				if(opType==0)
-				{
-					isEditedBuffer[index]=0;
-				}
-
-				saveData(oldKey3D.x,oldKey3D.y,oldKey3D.z,oldValue);
-
-				// "get"
-				if(opType==0)
-				{
-					const CacheValue && loadedData = loadData(newKey3D.x,newKey3D.y,newKey3D.z);
-					valueBuffer[index]=loadedData;
-					keyBuffer[index]=newKey3D;
-					return loadedData;
-				}
-				else /* "set" */
-				{
-					valueBuffer[index]=*value;
-					keyBuffer[index]=newKey3D;
-					return *value;
-				}
-			}
-			else // not edited
-			{
-				// "set"
-				if(opType == 1)
-				{
-					isEditedBuffer[index]=1;
-				}
-
-				// "get"
-				if(opType == 0)
-				{
-					const CacheValue && loadedData = loadData(newKey3D.x,newKey3D.y,newKey3D.z);
-					valueBuffer[index]=loadedData;
-					keyBuffer[index]=newKey3D;
-					return loadedData;
-				}
-				else // "set"
-				{
-					valueBuffer[index]=*value;
-					keyBuffer[index]=newKey3D;
-					return *value;
-				}
-			}
-
-		}
+		return DirectMappedNDCache<CacheKey,CacheValue,3>::accessDirectLocked(CacheKeyND<CacheKey,3>(keyX,keyY,keyZ),value,opType);
 	}
 
-
-
-private:
-	struct CacheKey3D
-	{
-		CacheKey3D():x(CacheKey()-1),y(CacheKey()-1),z(CacheKey()-1) { }
-		CacheKey3D(CacheKey xPrm, CacheKey yPrm, CacheKey zPrm):x(xPrm),y(yPrm),z(zPrm) { }
-		CacheKey x,y,z;
-	};
-	struct MutexWithoutFalseSharing
+	// direct mapped cache element access
+	// opType=0: get
+	// opType=1: set
+	CacheValue const accessDirect(const CacheKey & keyX,const CacheKey & keyY,const CacheKey & keyZ,const CacheValue * value, const bool opType = 0)
 	{
-		std::mutex mut;
-		char padding[256-sizeof(std::mutex) <= 0 ? 4:256-sizeof(std::mutex)];
-	};
-	const CacheKey sizeX;
-	const CacheKey sizeY;
-	const CacheKey sizeZ;
-	const CacheKey sizeXM1;
-	const CacheKey sizeYM1;
-	const CacheKey sizeZM1;
-
-	std::vector<MutexWithoutFalseSharing> mut;
-	std::vector<CacheValue> valueBuffer;
-	std::vector<unsigned char> isEditedBuffer;
-	std::vector<CacheKey3D> keyBuffer;
-
-	const std::function<CacheValue(CacheKey,CacheKey,CacheKey)>  loadData;
-	const std::function<void(CacheKey,CacheKey,CacheKey,CacheValue)>  saveData;
-
+		return DirectMappedNDCache<CacheKey,CacheValue,3>::accessDirect(CacheKeyND<CacheKey,3>(keyX,keyY,keyZ),value,opType);
+	}
 };
 
 
 
 
-
-
-
 #endif /* DIRECTMAPPED3DMULTITHREADCACHE_H_ */
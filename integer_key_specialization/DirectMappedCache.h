@@ -9,8 +9,17 @@
 #define DIRECTMAPPEDCACHE_H_
 
 #include<vector>
+#include<memory>
 #include<functional>
 #include<mutex>
+#include<iostream>
+#include<type_traits>
+#include"StridePrefetcher.h"
+#include"InsertionFilter.h"
+#include"../CacheWritePolicy.h"
+#if defined(__AVX2__)
+#include<immintrin.h>
+#endif
 
 
 /* Direct-mapped cache implementation
@@ -38,7 +47,7 @@ public:
 				const std::function<void(CacheKey,CacheValue)> & writeMiss,
 				const int zenithShards=4, /* unused for DirectMappedCache alone */
 				const int zenithLane=0 /* unused for DirectMappedCacheAlone*/
-				):size(numElements),sizeM1(numElements-1),loadData(readMiss),saveData(writeMiss)
+				):size(numElements),sizeM1(numElements-1),loadData(readMiss),saveData(writeMiss),writePolicy(CacheWritePolicy::WRITE_BACK)
 	{
 		// initialize buffers
 		for(size_t i=0;i<numElements;i++)
@@ -68,12 +77,27 @@ public:
 	{
 		const int n = key.size();
 		std::vector<CacheValue> result(n);
+		getMultiple(key.data(),result.data(),n);
+		return result;
+	}
 
-		for(int i=0;i<n;i++)
+	// batch version of get() that writes n values into out[0..n-1]
+	// when compiled with AVX2 (-mavx2) and keys are 32/64-bit integers and values are 32/64-bit trivially copyable types:
+	//		8 keys are resolved per iteration with SIMD tag computation, gathered key/value loads and a single compare
+	//		only the missing lanes go through accessDirect (cache-miss path)
+	// otherwise (or when prefetcher is enabled, its hit/miss bookkeeping is only in accessDirect) it is same as calling get() n times
+	inline
+	void getMultiple(const CacheKey * key, CacheValue * out, const int n)  noexcept
+	{
+		int i=0;
+#if defined(__AVX2__)
+		if(!prefetcher)
+			i=getMultipleAvx2(key,out,n);
+#endif
+		for(;i<n;i++)
 		{
-			result[i]=accessDirect(key[i],nullptr);
+			out[i]=accessDirect(key[i],nullptr);
 		}
-		return result;
 	}
 
 
@@ -107,6 +131,37 @@ public:
 		accessDirect(key,&val,1);
 	}
 
+	// attaches a stride-detecting prefetcher (see StridePrefetcher.h)
+	// 		after a cache-miss that continues a detected stride (e.g. sequential scan), next "degree" keys of the stream are loaded in same call
+	//		so that next accesses of the scan are cache-hits, first hit on a prefetched batch loads next batch
+	// keyLimit: number of keys of backing-store, only keys in [0,keyLimit) are prefetched
+	// numStreams: number of concurrent scans tracked
+	// degree: number of keys loaded ahead per miss
+	// call before using the cache (not thread-safe)
+	void enablePrefetcher(const CacheKey keyLimit, const int numStreams=4, const int degree=4)
+	{
+		prefetcher = std::make_unique<StridePrefetcher<CacheKey,1>>(CacheKeyND<CacheKey,1>(keyLimit),numStreams,degree);
+		prefetchedBuffer = std::vector<unsigned char>(size,0);
+	}
+
+	// selects which cache-misses install their key (see InsertionFilter.h), default is ALWAYS
+	// 		a miss that is not admitted reads next level (get) or writes next level (set) directly, without evicting a slot
+	// historySize: number of recently missed keys remembered by SECOND_ACCESS
+	// call before using the cache (not thread-safe)
+	void enableInsertionPolicy(const CacheInsertionPolicy policy, const size_t historySize = 1024*4)
+	{
+		insertionFilter = std::make_unique<InsertionFilter<CacheKey>>(policy,historySize);
+	}
+
+	// selects how "set" reaches backing-store (see CacheWritePolicy.h), default is WRITE_BACK
+	// 		WRITE_THROUGH: every set calls writeMiss, slots are never edited (flush has nothing to write)
+	// 		WRITE_AROUND: set of a key that is not cached calls writeMiss without evicting a slot
+	// call before using the cache (not thread-safe)
+	void enableWritePolicy(const CacheWritePolicy policy)
+	{
+		writePolicy = policy;
+	}
+
 	// use this before closing the backing-store to store the latest bits of data
 	void flush()
 	{
@@ -135,6 +190,50 @@ public:
 		// find tag mapped to the key
 		CacheKey tag = key & sizeM1;
 
+		if(prefetcher)
+		{
+			const bool miss = !(keyBuffer[tag] == key);
+			const bool prefetched = prefetchedBuffer[tag];
+			const CacheValue result = accessSlot(tag,key,value,opType,loadData,saveData);
+			prefetchedBuffer[tag]=0;
+			if(miss || prefetched)
+			{
+				const auto prefetchFunc = [&](const CacheKeyND<CacheKey,1> & next){ prefetch(next.k[0],tag); };
+				if(miss)
+					prefetcher->onMiss(CacheKeyND<CacheKey,1>(key),prefetchFunc);
+				else
+					prefetcher->onPrefetchHit(CacheKeyND<CacheKey,1>(key),prefetchFunc);
+			}
+			return result;
+		}
+		return accessSlot(tag,key,value,opType,loadData,saveData);
+	}
+
+	// same as accessDirect but cache-misses call load(key) / save(key,value) instead of readMiss / writeMiss
+	// 		load and save are template parameters so that a lambda calling next cache level is inlined (see CacheHierarchy.h)
+	// 		prefetcher is not used by this path
+	template<typename Load, typename Save>
+	inline
+	CacheValue const accessWith(const CacheKey & key,const CacheValue * value, const bool opType, const Load & load, const Save & save)
+	{
+		return accessSlot(key & sizeM1,key,value,opType,load,save);
+	}
+
+	// thread-safe version of accessWith
+	template<typename Load, typename Save>
+	inline
+	CacheValue const accessThreadSafeWith(const CacheKey & key,const CacheValue * value, const bool opType, const Load & load, const Save & save)
+	{
+		std::lock_guard<std::mutex> lg(mut);
+		return accessSlot(key & sizeM1,key,value,opType,load,save);
+	}
+
+private:
+	// cache access after tag is computed
+	template<typename Load, typename Save>
+	inline
+	CacheValue const accessSlot(const CacheKey tag, const CacheKey & key,const CacheValue * value, const bool opType, const Load & loadData, const Save & saveData)
+	{
 		// compare keys
 		if(keyBuffer[tag] == key)
 		{
@@ -143,13 +242,23 @@ public:
 			// "set"
 			if(opType == 1)
 			{
-				isEditedBuffer[tag]=1;
+				isEditedBuffer[tag]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
 				valueBuffer[tag]=*value;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					saveData(key,*value);
 			}
 
 			// cache hit value
 			return valueBuffer[tag];
 		}
+		else if((opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND) || (insertionFilter && !insertionFilter->admit(key)))
+		{
+			// bypass (write-around or not admitted): slot keeps its item
+			if(opType == 0)
+				return loadData(key);
+			saveData(key,*value);
+			return *value;
+		}
 		else // cache-miss
 		{
 			CacheValue oldValue = valueBuffer[tag];
@@ -178,6 +287,11 @@ public:
 				{
 					valueBuffer[tag]=*value;
 					keyBuffer[tag]=key;
+					if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					{
+						isEditedBuffer[tag]=0;
+						saveData(key,*value);
+					}
 					return *value;
 				}
 			}
@@ -186,7 +300,7 @@ public:
 				// "set"
 				if(opType == 1)
 				{
-					isEditedBuffer[tag]=1;
+					isEditedBuffer[tag]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
 				}
 
 				// "get"
@@ -201,6 +315,8 @@ public:
 				{
 					valueBuffer[tag]=*value;
 					keyBuffer[tag]=key;
+					if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+						saveData(key,*value);
 					return *value;
 				}
 			}
@@ -208,8 +324,108 @@ public:
 		}
 	}
 
+	// loads key into its slot if it is not there, writes evicted edited value back
+	// slot of the demand access (demandTag) is not touched
+	// slot is marked so that its first hit is reported to prefetcher, a marked (not yet used) slot is not evicted by another prefetch
+	inline
+	void prefetch(const CacheKey & key, const CacheKey demandTag)
+	{
+		const CacheKey tag = key & sizeM1;
+		if(tag == demandTag || keyBuffer[tag] == key || prefetchedBuffer[tag])
+			return;
+
+		if(isEditedBuffer[tag] == 1)
+		{
+			isEditedBuffer[tag]=0;
+			saveData(keyBuffer[tag],valueBuffer[tag]);
+		}
+		valueBuffer[tag]=loadData(key);
+		keyBuffer[tag]=key;
+		prefetchedBuffer[tag]=1;
+	}
+
+#if defined(__AVX2__)
+	static constexpr bool gatherable =
+			std::is_integral<CacheKey>::value && (sizeof(CacheKey)==4 || sizeof(CacheKey)==8) &&
+			std::is_trivially_copyable<CacheValue>::value && (sizeof(CacheValue)==4 || sizeof(CacheValue)==8);
+
+	// vectorized part of getMultiple, returns number of keys processed (a multiple of 8)
+	// hit lanes take values directly from gather, miss lanes are serviced in order by accessDirect
+	// (a miss can evict a slot that was hit by another lane of same group but that lane already has its value)
+	int getMultipleAvx2(const CacheKey * key, CacheValue * out, const int n) noexcept
+	{
+		if constexpr (!gatherable)
+		{
+			return 0;
+		}
+		else
+		{
+			// gather indices are signed 32-bit
+			if((size_t)sizeM1 > 0x7FFFFFFF)
+				return 0;
+
+			const int n8 = n & (~7);
+			for(int i=0;i<n8;i+=8)
+			{
+				__m256i index;
+				int hitMask;
+
+				if constexpr (sizeof(CacheKey)==4)
+				{
+					// tag = key & sizeM1 for 8 keys
+					const __m256i keys = _mm256_loadu_si256((const __m256i *)(key+i));
+					index = _mm256_and_si256(keys,_mm256_set1_epi32((int)sizeM1));
+					const __m256i oldKeys = _mm256_i32gather_epi32((const int *)keyBuffer.data(),index,4);
+					hitMask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(keys,oldKeys)));
+				}
+				else
+				{
+					// 2 x 4 keys of 64 bits
+					const __m256i mask = _mm256_set1_epi64x((long long)sizeM1);
+					const __m256i keysLo = _mm256_loadu_si256((const __m256i *)(key+i));
+					const __m256i keysHi = _mm256_loadu_si256((const __m256i *)(key+i+4));
+					const __m256i indexLo = _mm256_and_si256(keysLo,mask);
+					const __m256i indexHi = _mm256_and_si256(keysHi,mask);
+					const __m256i oldKeysLo = _mm256_i64gather_epi64((const long long *)keyBuffer.data(),indexLo,8);
+					const __m256i oldKeysHi = _mm256_i64gather_epi64((const long long *)keyBuffer.data(),indexHi,8);
+					hitMask = 	_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(keysLo,oldKeysLo))) |
+								(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(keysHi,oldKeysHi)))<<4);
+
+					// tags fit in 32 bits, pack low halves into 8 x 32-bit indices for value gather
+					const __m256i evenLanes = _mm256_setr_epi32(0,2,4,6,1,3,5,7);
+					index = _mm256_permute2x128_si256(
+								_mm256_permutevar8x32_epi32(indexLo,evenLanes),
+								_mm256_permutevar8x32_epi32(indexHi,evenLanes),0x20);
+				}
+
+				if constexpr (sizeof(CacheValue)==4)
+				{
+					_mm256_storeu_si256((__m256i *)(out+i),_mm256_i32gather_epi32((const int *)valueBuffer.data(),index,4));
+				}
+				else
+				{
+					_mm256_storeu_si256((__m256i *)(out+i),_mm256_i32gather_epi64((const long long *)valueBuffer.data(),_mm256_castsi256_si128(index),8));
+					_mm256_storeu_si256((__m256i *)(out+i+4),_mm256_i32gather_epi64((const long long *)valueBuffer.data(),_mm256_extracti128_si256(index,1),8));
+				}
+
+				// cache-miss lanes
+				const int missMask = (~hitMask) & 0xFF;
+				if(missMask)
+				{
+					for(int lane=0;lane<8;lane++)
+					{
+						if(missMask & (1<<lane))
+						{
+							out[i+lane]=accessDirect(key[i+lane],nullptr);
+						}
+					}
+				}
+			}
+			return n8;
+		}
+	}
+#endif
 
-private:
 	const CacheKey size;
 	const CacheKey sizeM1;
 	std::mutex mut;
@@ -219,7 +435,10 @@ private:
 	std::vector<CacheKey> keyBuffer;
 	const std::function<CacheValue(CacheKey)>  loadData;
 	const std::function<void(CacheKey,CacheValue)>  saveData;
-
+	std::unique_ptr<StridePrefetcher<CacheKey,1>> prefetcher;
+	std::vector<unsigned char> prefetchedBuffer;
+	std::unique_ptr<InsertionFilter<CacheKey>> insertionFilter;
+	CacheWritePolicy writePolicy;
 };
 
 
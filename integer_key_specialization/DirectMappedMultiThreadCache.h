@@ -9,8 +9,23 @@
 #define DIRECTMAPPEDMULTITHREADCACHE_H_
 
 #include<vector>
+#include<memory>
 #include<functional>
 #include<mutex>
+#include<atomic>
+#include<cstdint>
+#include<cstring>
+#include<type_traits>
+#include<iostream>
+#include<algorithm>
+#include"StridePrefetcher.h"
+#include"InsertionFilter.h"
+#include"../CacheWritePolicy.h"
+#include"StripedLockTable.h"
+#include"ParallelFor.h"
+#if defined(__SSE2__)
+#include<immintrin.h>
+#endif
 
 
 /* Direct-mapped cache implementation with granular locking (per-tag)
@@ -20,6 +35,12 @@
  * Intended to be used as LLC(last level cache) for CacheThreader instances
  * 															to optimize contentions out in multithreaded read-only scenarios
  * Can be used alone, as a read+write multi-threaded cache using getThreadSafe setThreadSafe methods but cache-hit ratio will not be good
+ * getThreadSafe cache-hits do not lock when key and value are trivially copyable (integers, floats, POD structs):
+ * 		key+value <= 8 bytes: 	each slot has an atomic 64-bit copy of (key,value), a hit is 1 atomic load (lock-free)
+ * 		bigger key+value: 		each slot has a sequence number that is odd while the slot is written (seqlock) and a copy of (key,value) in atomic 64-bit words
+ * 								a hit loads the words between 2 sequence checks (relaxed atomic loads, no data race)
+ * 		misses, setThreadSafe and failed optimistic reads take the lock as before
+ * number of active tags can be changed at run-time with resize() (within the number of tags allocated by constructor)
  * CacheKey: type of key (only integers: int, char, size_t)
  * CacheValue: type of value that is bound to key (same as above)
  * InternalKeyTypeInteger: type of tag found after modulo operationa (is important for maximum cache size. unsigned char = 255, unsigned int=1024*1024*1024*4)
@@ -27,6 +48,10 @@
 template<	typename CacheKey, typename CacheValue, typename InternalKeyTypeInteger=size_t>
 class DirectMappedMultiThreadCache
 {
+	static constexpr bool optimisticReadable = std::is_trivially_copyable<CacheKey>::value && std::is_trivially_copyable<CacheValue>::value;
+	static constexpr bool packedReadable = optimisticReadable && (sizeof(CacheKey)+sizeof(CacheValue) <= sizeof(uint64_t));
+	static constexpr size_t keyWords = (sizeof(CacheKey)+sizeof(uint64_t)-1)/sizeof(uint64_t);
+	static constexpr size_t slotWords = keyWords + (sizeof(CacheValue)+sizeof(uint64_t)-1)/sizeof(uint64_t);
 public:
 	// allocates buffers for numElements number of cache slots/lanes
 	// readMiss: 	cache-miss for read operations. User needs to give this function
@@ -38,22 +63,46 @@ public:
 	//				example: [&](MyClass key, MyAnotherClass value){ redis.set(key,value); }
 	//				takes a CacheKey as key and CacheValue as value
 	// numElements: has to be integer-power of 2 (e.g. 2,4,8,16,...)
-	// prepareForMultithreading: by default (true) it allocates an array of structs each with its own mutex to evade false-sharing during getThreadSafe/setThreadSafe calls
-	//          with a given "false" value, it does not allocate mutex array and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
-	//          true: allocates at least extra 256 bytes per cache tag
+	// prepareForMultithreading: by default (true) it allocates a striped lock table (see StripedLockTable.h) for getThreadSafe/setThreadSafe calls
+	//          with a given "false" value, it does not allocate lock table and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
+	// numLockStripes: number of mutexes (64 bytes each) shared by all tags, 0 = min(number of tags, 4096)
+	//          more stripes = less lock contention, fewer stripes = less memory
 	DirectMappedMultiThreadCache(CacheKey numElements,
 				const std::function<CacheValue(CacheKey)> & readMiss,
 				const std::function<void(CacheKey,CacheValue)> & writeMiss,
-				const bool prepareForMultithreading = true):size(numElements),sizeM1(numElements-1),loadData(readMiss),saveData(writeMiss)
+				const bool prepareForMultithreading = true,
+				const size_t numLockStripes = 0):size(numElements),sizeM1(numElements-1),loadData(readMiss),saveData(writeMiss),writePolicy(CacheWritePolicy::WRITE_BACK),exclusive(false),optimistic(false)
 	{
 		if(prepareForMultithreading)
-			mut = std::vector<MutexWithoutFalseSharing>(numElements);
+			mut = StripedLockTable(numElements,numLockStripes);
 		// initialize buffers
 		for(size_t i=0;i<numElements;i++)
 		{
 			valueBuffer.push_back(CacheValue());
 			isEditedBuffer.push_back(0);
-			keyBuffer.push_back(CacheKey()-1);
+			keyBuffer.push_back(emptyKey());
+		}
+
+		// lock-free read support
+		if(prepareForMultithreading && optimisticReadable)
+		{
+			optimistic = true;
+			if constexpr (packedReadable)
+			{
+				packedBuffer = std::unique_ptr<std::atomic<uint64_t>[]>(new std::atomic<uint64_t>[numElements]);
+				for(size_t i=0;i<(size_t)numElements;i++)
+					packedBuffer[i].store(pack(keyBuffer[i],valueBuffer[i]),std::memory_order_relaxed);
+			}
+			else
+			{
+				sequenceBuffer = std::unique_ptr<std::atomic<uint32_t>[]>(new std::atomic<uint32_t>[numElements]);
+				wordBuffer = std::unique_ptr<std::atomic<uint64_t>[]>(new std::atomic<uint64_t>[numElements*slotWords]);
+				for(size_t i=0;i<(size_t)numElements;i++)
+				{
+					sequenceBuffer[i].store(0,std::memory_order_relaxed);
+					storeSlotWords((CacheKey)i);
+				}
+			}
 		}
 	}
 
@@ -113,39 +162,94 @@ public:
 		accessDirectLocked(key,&val,1);
 	}
 
-	// use this before closing the backing-store to store the latest bits of data
-	void flush()
+	// attaches a stride-detecting prefetcher (see StridePrefetcher.h)
+	// 		after a cache-miss that continues a detected stride (e.g. sequential scan), next "degree" keys of the stream are loaded in same call
+	//		so that next accesses of the scan are cache-hits, first hit on a prefetched batch loads next batch
+	//		thread-safe methods prefetch after releasing the lock of the missed tag and lock each prefetched tag on its own
+	// keyLimit: number of keys of backing-store, only keys in [0,keyLimit) are prefetched
+	// numStreams: number of concurrent scans tracked
+	// degree: number of keys loaded ahead per miss
+	// call before using the cache (not thread-safe)
+	void enablePrefetcher(const CacheKey keyLimit, const int numStreams=4, const int degree=4)
+	{
+		prefetcher = std::make_unique<StridePrefetcher<CacheKey,1>>(CacheKeyND<CacheKey,1>(keyLimit),numStreams,degree);
+		prefetchedBuffer = std::vector<unsigned char>(size,0);
+	}
+
+	// selects which cache-misses install their key (see InsertionFilter.h), default is ALWAYS
+	// 		a miss that is not admitted reads next level (get) or writes next level (set) directly, without evicting a slot
+	// historySize: number of recently missed keys remembered by SECOND_ACCESS
+	// not used in exclusive mode (every promoted item has to be installed)
+	// call before using the cache (not thread-safe)
+	void enableInsertionPolicy(const CacheInsertionPolicy policy, const size_t historySize = 1024*4)
+	{
+		insertionFilter = std::make_unique<InsertionFilter<CacheKey>>(policy,historySize);
+	}
+
+	// selects how "set" reaches next level (see CacheWritePolicy.h), default is WRITE_BACK
+	// 		WRITE_THROUGH: every set calls writeMiss while its slot is locked, slots are never edited (flush has nothing to write)
+	// 		WRITE_AROUND: set of a key that is not cached calls writeMiss without evicting a slot
+	// not used in exclusive mode (next level does not keep a copy of a cached item)
+	// call before using the cache (not thread-safe)
+	void enableWritePolicy(const CacheWritePolicy policy)
+	{
+		writePolicy = policy;
+	}
+
+	// exclusive hierarchy mode (used by MultiLevelCache::enableExclusiveMode): an item is either in this cache or in next level, not in both
+	// promote: 	called on a miss instead of readMiss, moves key out of next level (or reads backing-store)
+	//				sets dirty=true if moved item was edited and not written to backing-store yet, then this cache becomes responsible for it
+	// demote: 		called for every evicted item (clean or edited) instead of writeMiss, moves it into next level with its dirty status
+	// discard:		called on a write-miss (new value is not read from next level), removes old copy of key from next level
+	//				otherwise an older edited copy in next level could be written to backing-store after the new value
+	// writeMiss is still used by flush()
+	// call before using the cache (not thread-safe)
+	void enableExclusiveMode(const std::function<CacheValue(CacheKey,bool &)> & promote, const std::function<void(CacheKey,CacheValue,bool)> & demote,
+			const std::function<void(CacheKey)> & discard = nullptr)
+	{
+		promoteData = promote;
+		demoteData = demote;
+		discardData = discard;
+		exclusive = true;
+	}
+
+	// starts recording lock statistics per lock stripe (acquisitions, contention, wait/hold time histograms)
+	// lock-free hits of getThreadSafe (see class description) take no lock and are not recorded
+	void enableLockProfiler()
 	{
+		mut.enableProfiler();
+	}
+
+	// lock statistics per stripe (tag i is guarded by stripe i % number of stripes), empty if cache is not prepared for multithreading
+	// example: cache.getLockProfiler().report(std::cout,8,"stripe");
+	const LockProfiler & getLockProfiler() const
+	{
+		return mut.getProfiler();
+	}
+
+	// use this before closing the backing-store to store the latest bits of data, items stay in cache as clean
+	// with a lock table, it can run while other threads use thread-safe methods: lock of a tag is held only while its edited item is written
+	// 		every item that was edited before flush() started is written (by flush or by its eviction) before flush() returns
+	//		an item edited again after it was written stays edited for next flush
+	// parallelism: number of threads that write edited tags back in parallel (each takes a range of tags)
+	//				1 = calling thread only, 0 = std::thread::hardware_concurrency()
+	//				helper threads are started and joined by each call (see parallelFor in ParallelFor.h)
+	//				writeMiss is called from multiple threads when parallelism != 1
+	void flush(const int parallelism = 1)
+	{
+		flushWith(saveData,parallelism);
+	}
+
+	// same as flush() but edited items are written with save(key,value) instead of writeMiss
+	// (exclusive mode of MultiLevelCache writes L1 items directly to backing-store instead of leaving a copy in L2)
+	template<typename Save>
+	void flushWith(const Save & save, const int parallelism = 1)
+	{
+		// resize() would move items between ranges of flushing threads
+		std::lock_guard<std::mutex> lgf(flushMut);
 		try
 		{
-			if(mut.size()>0)
-			{
-				for (size_t i=0;i<size;i++)
-				{
-					std::lock_guard<std::mutex> lg(mut[i].mut);
-					if (isEditedBuffer[i] == 1)
-					{
-						isEditedBuffer[i]=0;
-						auto oldKey = keyBuffer[i];
-						auto oldValue = valueBuffer[i];
-						saveData(oldKey,oldValue);
-					}
-				}
-			}
-			else
-			{
-				for (size_t i=0;i<size;i++)
-				{
-					if (isEditedBuffer[i] == 1)
-					{
-						isEditedBuffer[i]=0;
-						auto oldKey = keyBuffer[i];
-						auto oldValue = valueBuffer[i];
-						saveData(oldKey,oldValue);
-					}
-				}
-			}
-
+			parallelForChunks(size,parallelism,[&](const size_t begin, const size_t end){ flushRange(begin,end,save); });
 		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
 	}
 
@@ -156,91 +260,370 @@ public:
 	{
 
 		// find tag mapped to the key
-		CacheKey tag = key & sizeM1;
-		std::lock_guard<std::mutex> lg(mut[tag].mut); // N parallel locks in-flight = less contention in multi-threading
+		CacheKey tag = tagOf(key);
 
-		// compare keys
-		if(keyBuffer[tag] == key)
+		// lock-free cache-hit (prefetcher needs to observe hits under lock)
+		if(opType == 0 && optimistic && !prefetcher)
 		{
-			// cache-hit
+			CacheValue result;
+			if(readOptimistic(tag,key,result))
+				return result;
+		}
 
-			// "set"
-			if(opType == 1)
+		if(prefetcher)
+		{
+			// prefetching is done after the lock is released, so that it can lock other tags
+			bool miss;
+			bool prefetched;
+			CacheValue result;
 			{
-				isEditedBuffer[tag]=1;
-				valueBuffer[tag]=*value;
+				StripedLockTable::Guard lg(mut,tag);
+				tag = tagOf(key);
+				miss = !(keyBuffer[tag] == key);
+				prefetched = prefetchedBuffer[tag];
+				result = accessSlot(tag,key,value,opType,loadData,saveData);
+				prefetchedBuffer[tag]=0;
 			}
+			if(miss || prefetched)
+				prefetchAfterAccess(key,tag,miss,true);
+			return result;
+		}
 
-			// cache hit value
-			return valueBuffer[tag];
+		StripedLockTable::Guard lg(mut,tag); // N parallel locks in-flight = less contention in multi-threading
+		return accessSlot(tagOf(key),key,value,opType,loadData,saveData);
+	}
+
+	// direct mapped cache element access
+	// opType 0 = get
+	// opType 1 = set
+	CacheValue const accessDirect(const CacheKey & key,const CacheValue * value, const bool opType = 0)
+	{
+
+		// find tag mapped to the key
+		CacheKey tag = tagOf(key);
+
+		if(prefetcher)
+		{
+			const bool miss = !(keyBuffer[tag] == key);
+			const bool prefetched = prefetchedBuffer[tag];
+			const CacheValue result = accessSlot(tag,key,value,opType,loadData,saveData);
+			prefetchedBuffer[tag]=0;
+			if(miss || prefetched)
+				prefetchAfterAccess(key,tag,miss,false);
+			return result;
 		}
-		else // cache-miss
+		return accessSlot(tag,key,value,opType,loadData,saveData);
+	}
+
+	// same as accessDirect but cache-misses call load(key) / save(key,value) instead of readMiss / writeMiss
+	// 		load and save are template parameters so that a lambda calling next cache level is inlined (see CacheHierarchy.h)
+	// 		prefetcher is not used by this path
+	template<typename Load, typename Save>
+	inline
+	CacheValue const accessWith(const CacheKey & key,const CacheValue * value, const bool opType, const Load & load, const Save & save)
+	{
+		return accessSlot(tagOf(key),key,value,opType,load,save);
+	}
+
+	// thread-safe version of accessWith, cache-hits of get are lock-free if optimistic reads are enabled
+	template<typename Load, typename Save>
+	inline
+	CacheValue const accessThreadSafeWith(const CacheKey & key,const CacheValue * value, const bool opType, const Load & load, const Save & save)
+	{
+		const CacheKey tag = tagOf(key);
+		if(opType == 0 && optimistic)
 		{
-			CacheValue oldValue = valueBuffer[tag];
-			CacheKey oldKey = keyBuffer[tag];
+			CacheValue result;
+			if(readOptimistic(tag,key,result))
+				return result;
+		}
+		StripedLockTable::Guard lg(mut,tag);
+		return accessSlot(tagOf(key),key,value,opType,load,save);
+	}
 
-			// eviction algorithm start
-			if(isEditedBuffer[tag] == 1)
-			{
-				// if it is "get"
-				if(opType==0)
-				{
-					isEditedBuffer[tag]=0;
-				}
+	// lets resize() go down to minSize tags (rounded up to power of 2) by reducing number of lock stripes to minSize if there are more
+	// fewer stripes = more lock contention between threads, a profiler enabled by enableLockProfiler keeps recording (statistics restart)
+	// call before using the cache (not thread-safe)
+	void enableResizing(const size_t minSize)
+	{
+		const size_t stripes = std::max(minSize,(size_t)1);
+		if(mut.size() > stripes)
+		{
+			const bool profiled = mut.getProfiler().isEnabled();
+			mut = StripedLockTable(size,stripes);
+			if(profiled)
+				mut.enableProfiler();
+		}
+	}
 
-				saveData(oldKey,oldValue);
+	// changes number of active tags (thread-safe, locks all tags, waits for a running flush, call rarely)
+	// numElements: rounded down to integer power of 2, at least number of lock stripes (tag of a key has to keep its stripe), at most number of allocated tags
+	// 		shrinking: items of disabled tags are evicted (edited items are written to next level, exclusive mode moves all of them to next level)
+	// 		growing: items move to their tag in the bigger range, nothing is evicted
+	// lock-free readers keep working during resize: an item is always either in the tag of its key for current size or not in cache
+	void resize(const size_t numElements)
+	{
+		size_t newSize = 1;
+		while(newSize*2 <= numElements && newSize*2 <= (size_t)size)
+			newSize <<= 1;
+		if(newSize < minimumSize())
+			newSize = minimumSize();
+
+		std::lock_guard<std::mutex> lgf(flushMut);
+		for(size_t i=0;i<mut.size();i++)
+			mut.stripe(i).lock();
+		try
+		{
+			resizeLocked(newSize);
+		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
+		for(size_t i=0;i<mut.size();i++)
+			mut.stripe(i).unlock();
+	}
 
-				// "get"
-				if(opType==0)
-				{
-					const CacheValue && loadedData = loadData(key);
-					valueBuffer[tag]=loadedData;
-					keyBuffer[tag]=key;
-					return loadedData;
-				}
-				else /* "set" */
-				{
-					valueBuffer[tag]=*value;
-					keyBuffer[tag]=key;
-					return *value;
-				}
+	// number of active tags
+	inline
+	size_t activeSize() const noexcept
+	{
+		return (size_t)sizeM1.load(std::memory_order_relaxed) + 1;
+	}
+
+	// smallest size accepted by resize()
+	size_t minimumSize() const noexcept
+	{
+		return std::max(std::min(mut.size(),(size_t)size),(size_t)1);
+	}
+
+private:
+	// tag of key in active range
+	// stripe of a tag does not depend on active size (size >= number of stripes), so a tag computed before taking its lock is re-computed after it
+	inline
+	CacheKey tagOf(const CacheKey & key) const noexcept
+	{
+		return key & sizeM1.load(std::memory_order_acquire);
+	}
+
+	// all tags are locked
+	void resizeLocked(const size_t newSize)
+	{
+		const size_t oldSize = activeSize();
+		const CacheKey newM1 = (CacheKey)(newSize - 1);
+		if(newSize < oldSize)
+		{
+			for(size_t i=newSize;i<oldSize;i++)
+			{
+				const CacheKey tag = (CacheKey)i;
+				if(keyBuffer[tag] == emptyKey())
+					continue;
+				if(optimistic)
+					beginSlotWrite(tag);
+				if(exclusive)
+					evictExclusive(tag);
+				else if(isEditedBuffer[tag] == 1)
+					saveData(keyBuffer[tag],valueBuffer[tag]);
+				clearSlot(tag);
+				if(optimistic)
+					endSlotWrite(tag);
 			}
-			else // not edited
+		}
+		else
+		{
+			for(size_t i=0;i<oldSize;i++)
 			{
-				// "set"
-				if(opType == 1)
-				{
-					isEditedBuffer[tag]=1;
-				}
+				const CacheKey tag = (CacheKey)i;
+				const CacheKey newTag = keyBuffer[tag] & newM1;
+				if(keyBuffer[tag] == emptyKey() || newTag == tag)
+					continue;
 
-				// "get"
-				if(opType == 0)
+				// new tag is in the range that was disabled, so it is empty
+				if(optimistic)
 				{
-					const CacheValue && loadedData = loadData(key);
-					valueBuffer[tag]=loadedData;
-					keyBuffer[tag]=key;
-					return loadedData;
+					beginSlotWrite(newTag);
+					beginSlotWrite(tag);
 				}
-				else // "set"
+				keyBuffer[newTag] = keyBuffer[tag];
+				valueBuffer[newTag] = valueBuffer[tag];
+				isEditedBuffer[newTag] = isEditedBuffer[tag];
+				clearSlot(tag);
+				if(optimistic)
 				{
-					valueBuffer[tag]=*value;
-					keyBuffer[tag]=key;
-					return *value;
+					endSlotWrite(tag);
+					endSlotWrite(newTag);
 				}
 			}
+		}
+		sizeM1.store(newM1,std::memory_order_release);
+	}
+
+	inline
+	void clearSlot(const CacheKey tag)
+	{
+		keyBuffer[tag] = emptyKey();
+		valueBuffer[tag] = CacheValue();
+		isEditedBuffer[tag] = 0;
+		if(prefetcher)
+			prefetchedBuffer[tag] = 0;
+	}
 
+	// cache access after tag is computed (and locked, if thread-safe)
+	// slot changes (set, miss) are published to lock-free readers
+	template<typename Load, typename Save>
+	inline
+	CacheValue const accessSlot(const CacheKey tag, const CacheKey & key,const CacheValue * value, const bool opType, const Load & loadData, const Save & saveData)
+	{
+		if(optimistic && (opType == 1 || !(keyBuffer[tag] == key)))
+		{
+			beginSlotWrite(tag);
+			try
+			{
+				const CacheValue result = accessBuffers(tag,key,value,opType,loadData,saveData);
+				endSlotWrite(tag);
+				return result;
+			}
+			catch(...)
+			{
+				endSlotWrite(tag);
+				throw;
+			}
 		}
+		return accessBuffers(tag,key,value,opType,loadData,saveData);
 	}
 
-	// direct mapped cache element access
-	// opType 0 = get
-	// opType 1 = set
-	CacheValue const accessDirect(const CacheKey & key,const CacheValue * value, const bool opType = 0)
+	// lock-free read of a slot, returns false if key is not in slot or if slot is being written (then caller takes the lock)
+	inline
+	bool readOptimistic(const CacheKey tag, const CacheKey & key, CacheValue & result) const noexcept
 	{
+		if constexpr (packedReadable)
+		{
+			const uint64_t word = packedBuffer[tag].load(std::memory_order_acquire);
+			CacheKey storedKey;
+			std::memcpy(&storedKey,&word,sizeof(CacheKey));
+			if(!(storedKey == key))
+				return false;
+			std::memcpy(&result,reinterpret_cast<const char *>(&word)+sizeof(CacheKey),sizeof(CacheValue));
+			return true;
+		}
+		else if constexpr (optimisticReadable)
+		{
+			// words may be loaded while a writer changes them, a torn copy is discarded by the second sequence check
+			// keyBuffer/valueBuffer are not touched without lock, so there is no data race (thread-sanitizer clean)
+			const uint32_t sequence = sequenceBuffer[tag].load(std::memory_order_acquire);
+			if(sequence & 1)
+				return false;
+			const std::atomic<uint64_t> * slot = wordBuffer.get() + (size_t)tag*slotWords;
+			CacheKey storedKey;
+			loadWords(slot,&storedKey,sizeof(CacheKey));
+			if(!(storedKey == key))
+				return false;
+			loadWords(slot+keyWords,&result,sizeof(CacheValue));
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return sequenceBuffer[tag].load(std::memory_order_relaxed) == sequence;
+		}
+		else
+		{
+			return false;
+		}
+	}
 
-		// find tag mapped to the key
-		CacheKey tag = key & sizeM1;
+	// seqlock: sequence becomes odd before slot is written
+	inline
+	void beginSlotWrite(const CacheKey tag) noexcept
+	{
+		if constexpr (optimisticReadable && !packedReadable)
+		{
+			sequenceBuffer[tag].store(sequenceBuffer[tag].load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+		}
+	}
 
+	// seqlock: (key,value) is copied to atomic words, then sequence becomes even, packed: new (key,value) is published with 1 atomic store
+	inline
+	void endSlotWrite(const CacheKey tag) noexcept
+	{
+		if constexpr (packedReadable)
+		{
+			packedBuffer[tag].store(pack(keyBuffer[tag],valueBuffer[tag]),std::memory_order_release);
+		}
+		else if constexpr (optimisticReadable)
+		{
+			storeSlotWords(tag);
+			sequenceBuffer[tag].store(sequenceBuffer[tag].load(std::memory_order_relaxed)+1,std::memory_order_release);
+		}
+	}
+
+	// seqlock copy of a slot, written only while its sequence is odd (or before the cache is shared)
+	inline
+	void storeSlotWords(const CacheKey tag) noexcept
+	{
+		if constexpr (optimisticReadable && !packedReadable)
+		{
+			std::atomic<uint64_t> * slot = wordBuffer.get() + (size_t)tag*slotWords;
+			storeWords(slot,&keyBuffer[tag],sizeof(CacheKey));
+			storeWords(slot+keyWords,&valueBuffer[tag],sizeof(CacheValue));
+		}
+	}
+
+	// atomic words --> object
+	// words are joined in a vector register before they are stored, so that a 16/32-byte copy of the object right after this
+	// 		does not wait for 8-byte stores to retire (store-forwarding stall makes a seqlock hit ~3x slower)
+	static inline
+	void loadWords(const std::atomic<uint64_t> * words, void * object, const size_t bytes) noexcept
+	{
+		size_t i=0;
+		char * out = static_cast<char *>(object);
+#if defined(__AVX2__)
+		for(;(i+4)*sizeof(uint64_t)<=bytes;i+=4)
+		{
+			const __m256i chunk = _mm256_set_epi64x((long long)words[i+3].load(std::memory_order_relaxed),(long long)words[i+2].load(std::memory_order_relaxed),
+					(long long)words[i+1].load(std::memory_order_relaxed),(long long)words[i].load(std::memory_order_relaxed));
+			_mm256_storeu_si256((__m256i *)(out+i*sizeof(uint64_t)),chunk);
+		}
+#endif
+#if defined(__SSE2__)
+		for(;(i+2)*sizeof(uint64_t)<=bytes;i+=2)
+		{
+			const __m128i chunk = _mm_set_epi64x((long long)words[i+1].load(std::memory_order_relaxed),(long long)words[i].load(std::memory_order_relaxed));
+			_mm_storeu_si128((__m128i *)(out+i*sizeof(uint64_t)),chunk);
+		}
+#endif
+		for(;i*sizeof(uint64_t)<bytes;i++)
+		{
+			const uint64_t word = words[i].load(std::memory_order_relaxed);
+			std::memcpy(out+i*sizeof(uint64_t),&word,std::min(bytes-i*sizeof(uint64_t),sizeof(uint64_t)));
+		}
+	}
+
+	// object --> atomic words
+	static inline
+	void storeWords(std::atomic<uint64_t> * words, const void * object, const size_t bytes) noexcept
+	{
+		for(size_t i=0;i*sizeof(uint64_t)<bytes;i++)
+		{
+			uint64_t word = 0;
+			std::memcpy(&word,static_cast<const char *>(object)+i*sizeof(uint64_t),std::min(bytes-i*sizeof(uint64_t),sizeof(uint64_t)));
+			words[i].store(word,std::memory_order_relaxed);
+		}
+	}
+
+	inline
+	bool writesThrough() const noexcept
+	{
+		return writePolicy == CacheWritePolicy::WRITE_THROUGH && !exclusive;
+	}
+
+	static inline
+	uint64_t pack(const CacheKey & key, const CacheValue & value) noexcept
+	{
+		uint64_t word = 0;
+		std::memcpy(&word,&key,sizeof(CacheKey));
+		std::memcpy(reinterpret_cast<char *>(&word)+sizeof(CacheKey),&value,sizeof(CacheValue));
+		return word;
+	}
+
+	// cache access on key/value/dirty buffers
+	template<typename Load, typename Save>
+	inline
+	CacheValue const accessBuffers(const CacheKey tag, const CacheKey & key,const CacheValue * value, const bool opType, const Load & loadData, const Save & saveData)
+	{
 		// compare keys
 		if(keyBuffer[tag] == key)
 		{
@@ -249,13 +632,47 @@ public:
 			// "set"
 			if(opType == 1)
 			{
-				isEditedBuffer[tag]=1;
+				isEditedBuffer[tag]=!writesThrough();
 				valueBuffer[tag]=*value;
+				if(writesThrough())
+					saveData(key,*value);
 			}
 
 			// cache hit value
 			return valueBuffer[tag];
 		}
+		else if(!exclusive && ((opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND) || (insertionFilter && !insertionFilter->admit(key))))
+		{
+			// bypass (write-around or not admitted): slot keeps its item
+			if(opType == 0)
+				return loadData(key);
+			saveData(key,*value);
+			return *value;
+		}
+		else if(exclusive)
+		{
+			evictExclusive(tag);
+
+			// "get"
+			if(opType == 0)
+			{
+				bool dirty = false;
+				const CacheValue && loadedData = promoteData(key,dirty);
+				valueBuffer[tag]=loadedData;
+				keyBuffer[tag]=key;
+				isEditedBuffer[tag]=dirty;
+				return loadedData;
+			}
+			else // "set"
+			{
+				if(discardData)
+					discardData(key);
+				valueBuffer[tag]=*value;
+				keyBuffer[tag]=key;
+				isEditedBuffer[tag]=1;
+				return *value;
+			}
+		}
 		else // cache-miss
 		{
 			CacheValue oldValue = valueBuffer[tag];
@@ -284,6 +701,11 @@ public:
 				{
 					valueBuffer[tag]=*value;
 					keyBuffer[tag]=key;
+					if(writesThrough())
+					{
+						isEditedBuffer[tag]=0;
+						saveData(key,*value);
+					}
 					return *value;
 				}
 			}
@@ -292,7 +714,7 @@ public:
 				// "set"
 				if(opType == 1)
 				{
-					isEditedBuffer[tag]=1;
+					isEditedBuffer[tag]=!writesThrough();
 				}
 
 				// "get"
@@ -307,6 +729,8 @@ public:
 				{
 					valueBuffer[tag]=*value;
 					keyBuffer[tag]=key;
+					if(writesThrough())
+						saveData(key,*value);
 					return *value;
 				}
 			}
@@ -314,23 +738,135 @@ public:
 		}
 	}
 
+	// exclusive mode: slot content (if it is not the initial empty key) moves to next level, edited or not
+	inline
+	void evictExclusive(const CacheKey tag)
+	{
+		if(!(keyBuffer[tag] == emptyKey()))
+		{
+			demoteData(keyBuffer[tag],valueBuffer[tag],isEditedBuffer[tag] == 1);
+		}
+		isEditedBuffer[tag]=0;
+	}
 
-private:
-	struct MutexWithoutFalseSharing
+	// key of a slot that was never used
+	static inline
+	CacheKey emptyKey() noexcept
+	{
+		return CacheKey()-1;
+	}
+
+	// writes edited tags in [begin,end) back to backing-store
+	template<typename Save>
+	void flushRange(const size_t begin, const size_t end, const Save & saveData)
+	{
+		if(mut.size()>0)
+		{
+			for (size_t i=begin;i<end;i++)
+			{
+				StripedLockTable::Guard lg(mut,i);
+				if (isEditedBuffer[i] == 1)
+				{
+					isEditedBuffer[i]=0;
+					auto oldKey = keyBuffer[i];
+					auto oldValue = valueBuffer[i];
+					saveData(oldKey,oldValue);
+				}
+			}
+		}
+		else
+		{
+			for (size_t i=begin;i<end;i++)
+			{
+				if (isEditedBuffer[i] == 1)
+				{
+					isEditedBuffer[i]=0;
+					auto oldKey = keyBuffer[i];
+					auto oldValue = valueBuffer[i];
+					saveData(oldKey,oldValue);
+				}
+			}
+		}
+	}
+
+	// feeds a cache-miss key (or first hit on a prefetched key) to prefetcher and loads the predicted keys
+	// locked: prefetcher state is guarded by its own mutex (skipped if another thread is prefetching) and each predicted tag is locked separately
+	void prefetchAfterAccess(const CacheKey & key, const CacheKey demandTag, const bool miss, const bool locked)
 	{
-		std::mutex mut;
-		char padding[256-sizeof(std::mutex) <= 0 ? 4:256-sizeof(std::mutex)];
-	};
+		std::unique_lock<std::mutex> lck(prefetcherMut,std::defer_lock);
+		if(locked && !lck.try_lock())
+			return;
+
+		const auto prefetchFunc = [&](const CacheKeyND<CacheKey,1> & next){
+			if(locked)
+			{
+				StripedLockTable::Guard lg(mut,tagOf(next.k[0]));
+				prefetch(next.k[0],demandTag);
+			}
+			else
+				prefetch(next.k[0],demandTag);
+		};
+		if(miss)
+			prefetcher->onMiss(CacheKeyND<CacheKey,1>(key),prefetchFunc);
+		else
+			prefetcher->onPrefetchHit(CacheKeyND<CacheKey,1>(key),prefetchFunc);
+	}
+
+	// loads key into its slot if it is not there, writes evicted edited value back
+	// slot of the demand access (demandTag) is not touched
+	// slot is marked so that its first hit is reported to prefetcher, a marked (not yet used) slot is not evicted by another prefetch
+	inline
+	void prefetch(const CacheKey & key, const CacheKey demandTag)
+	{
+		const CacheKey tag = tagOf(key);
+		if(tag == demandTag || keyBuffer[tag] == key || prefetchedBuffer[tag])
+			return;
+
+		bool dirty = false;
+		if(exclusive)
+		{
+			evictExclusive(tag);
+		}
+		else if(isEditedBuffer[tag] == 1)
+		{
+			isEditedBuffer[tag]=0;
+			saveData(keyBuffer[tag],valueBuffer[tag]);
+		}
+		const CacheValue loadedData = exclusive ? promoteData(key,dirty) : loadData(key);
+		if(optimistic)
+			beginSlotWrite(tag);
+		valueBuffer[tag]=loadedData;
+		keyBuffer[tag]=key;
+		isEditedBuffer[tag]=dirty;
+		if(optimistic)
+			endSlotWrite(tag);
+		prefetchedBuffer[tag]=1;
+	}
+
 	const CacheKey size;
-	const CacheKey sizeM1;
-	std::vector<MutexWithoutFalseSharing> mut;
+	std::atomic<CacheKey> sizeM1;
+	StripedLockTable mut;
 
 	std::vector<CacheValue> valueBuffer;
 	std::vector<unsigned char> isEditedBuffer;
 	std::vector<CacheKey> keyBuffer;
 	const std::function<CacheValue(CacheKey)>  loadData;
 	const std::function<void(CacheKey,CacheValue)>  saveData;
-
+	std::function<CacheValue(CacheKey,bool &)> promoteData;
+	std::function<void(CacheKey,CacheValue,bool)> demoteData;
+	std::function<void(CacheKey)> discardData;
+	CacheWritePolicy writePolicy;
+	bool exclusive;
+	std::unique_ptr<StridePrefetcher<CacheKey,1>> prefetcher;
+	std::vector<unsigned char> prefetchedBuffer;
+	std::mutex prefetcherMut;
+	std::mutex flushMut;
+	std::unique_ptr<InsertionFilter<CacheKey>> insertionFilter;
+
+	bool optimistic;
+	std::unique_ptr<std::atomic<uint64_t>[]> packedBuffer;
+	std::unique_ptr<std::atomic<uint32_t>[]> sequenceBuffer;
+	std::unique_ptr<std::atomic<uint64_t>[]> wordBuffer;
 };
 
 
@@ -0,0 +1,835 @@
+/*
+ * DirectMappedNDCache.h
+ *
+ *  Created on: Nov 7, 2021
+ *      Author: tugrul
+ */
+
+#ifndef DIRECTMAPPEDNDCACHE_H_
+#define DIRECTMAPPEDNDCACHE_H_
+
+#include<vector>
+#include<array>
+#include<memory>
+#include<algorithm>
+#include<utility>
+#include<functional>
+#include<mutex>
+#include<iostream>
+#include"CacheKeyND.h"
+#include"StridePrefetcher.h"
+#include"StripedLockTable.h"
+#include"ParallelFor.h"
+#include"../CacheWritePolicy.h"
+#if defined(__BMI2__)
+#include<immintrin.h>
+#endif
+
+
+/* N-dimensional Direct-mapped cache implementation with granular locking (per-tag)
+ * DirectMapped2DMultiThreadCache and DirectMapped3DMultiThreadCache are N=2 and N=3 versions of this
+ *       Only usable for integer type keys in range [0,maxPositive-1] (if key is int then "-1" not usable, if key is uint16_t then "65535" not usable)
+ *       since locking protects only items/keys, also the user should make cache-miss functions thread-safe (i.e. adding a lock-guard)
+ *       unless backing-store is thread-safe already (or has multi-thread support already)
+ * Intended to be used as LLC(last level cache) for CacheThreader instances with getThreadSafe setThreadSafe methods or single threaded with get/set
+ * Can be used alone, as a read+write multi-threaded cache using getThreadSafe setThreadSafe methods but cache-hit ratio will not be good
+ * CacheKey: type of key (only integers: int, char, size_t, uint16_t, ...)
+ * CacheValue: type of value that is bound to key (same as above)
+ * N: number of dimensions = number of keys (coordinates) per get/set call and per cache-miss call
+ * Optionally tiled: cache-miss functions work on whole tiles (e.g. 8x8 pixels) instead of single elements
+ * 		4D example for time-varying volume: get(x,y,z,t)
+ */
+template<	typename CacheKey, typename CacheValue, size_t N>
+class DirectMappedNDCache
+{
+	static_assert(N>0,"at least 1 dimension required");
+public:
+	using CacheKeyNDType = CacheKeyND<CacheKey,N>;
+
+	// allocates buffers for numElements[0] x numElements[1] x ... numElements[N-1] number of cache slots/lanes
+	// readMiss: 	cache-miss for read operations. User needs to give this function
+	// 				to let the cache automatically get data from backing-store
+	//				example: [&](MyClass keyX, MyClass keyY, MyClass keyZ, MyClass keyW){ return backingStore.get(keyX,keyY,keyZ,keyW); }
+	//				takes N CacheKey values as key, returns CacheValue as value
+	// writeMiss: 	cache-miss for write operations. User needs to give this function
+	// 				to let the cache automatically set data to backing-store
+	//				example: [&](MyClass keyX, MyClass keyY, MyClass keyZ, MyClass keyW, MyAnotherClass value){ backingStore.set(keyX,keyY,keyZ,keyW,value); }
+	//				takes N CacheKey values as key and CacheValue as value
+	// numElements: each has to be integer-power of 2 (e.g. 2,4,8,16,...)
+	// prepareForMultithreading: by default (true) it allocates a striped lock table (see StripedLockTable.h) for getThreadSafe/setThreadSafe calls
+	//          with a given "false" value, it does not allocate lock table and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
+	// numLockStripes: number of mutexes (64 bytes each) shared by all tags (tiles, in tiled mode), 0 = min(number of tags, 4096)
+	//          more stripes = less lock contention, fewer stripes = less memory
+	// zOrderLayout: by default (false) slots are placed row-major like C++ arrays
+	//			with a given "true" value, slots (values, keys, dirty flags, locks) are placed in Morton (Z) order:
+	//			bits of tags are interleaved so that neighbors in all dimensions tend to share same 64-byte line & same page
+	//			(e.g. 2D with 4-byte values: a 4x4 pixel block per cache line instead of 16x1)
+	//			tag interleaving uses BMI2 pdep instruction when compiled with -mbmi2 (slow on pre-Zen3 AMD CPUs), software bit-deposit otherwise
+	DirectMappedNDCache(const std::array<CacheKey,N> & numElements,
+				const ReadMissFunctionND<CacheKey,CacheValue,N> & readMiss,
+				const WriteMissFunctionND<CacheKey,CacheValue,N> & writeMiss,
+				const bool prepareForMultithreading = true,
+				const bool zOrderLayout = false,
+				const size_t numLockStripes = 0):zOrder(zOrderLayout),tiled(false),writePolicy(CacheWritePolicy::WRITE_BACK),loadData(readMiss),saveData(writeMiss)
+	{
+		std::array<CacheKey,N> tileElements;
+		tileElements.fill(1);
+		initialize(numElements,tileElements,prepareForMultithreading,numLockStripes);
+	}
+
+	// tiled version: a cache-miss loads (and an eviction writes) a whole tile of tileElements[0] x tileElements[1] x ... elements with one call
+	// 			keys of a tile: [origin[i], origin[i] + tileElements[i]) for each dimension i, origin[i] is a multiple of tileElements[i]
+	//			all elements of a tile are cached together (1 tag, 1 dirty flag, 1 lock per tile)
+	// readMissTile: 	fills a tile from backing-store, tile is row-major: tile[(x-x0)*tileY + (y-y0)] for 2D, tile[((x-x0)*tileY + (y-y0))*tileZ + (z-z0)] for 3D
+	//					example: [&](int x0, int y0, float * tile){ noise.generate8x8(x0,y0,tile); }
+	// writeMissTile: 	writes an edited tile back to backing-store, same layout
+	//					example: [&](int x0, int y0, const float * tile){ image.store8x8(x0,y0,tile); }
+	// tileElements: each has to be integer-power of 2 and not greater than numElements of same dimension (e.g. 8x8 for 2D, 4x4x4 for 3D)
+	DirectMappedNDCache(const std::array<CacheKey,N> & numElements,
+				const std::array<CacheKey,N> & tileElements,
+				const ReadTileFunctionND<CacheKey,CacheValue,N> & readMissTile,
+				const WriteTileFunctionND<CacheKey,CacheValue,N> & writeMissTile,
+				const bool prepareForMultithreading = true,
+				const bool zOrderLayout = false,
+				const size_t numLockStripes = 0):zOrder(zOrderLayout),tiled(true),writePolicy(CacheWritePolicy::WRITE_BACK),loadTileData(readMissTile),saveTileData(writeMissTile)
+	{
+		initialize(numElements,tileElements,prepareForMultithreading,numLockStripes);
+	}
+
+
+
+	// get element from cache, row-major like C++ multi-dimensional arrays
+	// if cache doesn't find it in buffers,
+	// then cache gets data from backing-store
+	// then returns the result to user
+	// then cache is available from RAM on next get/set access with same key
+	template<typename ... Keys>
+	inline
+	const CacheValue get(const Keys & ... keys)  noexcept
+	{
+		return accessDirect(CacheKeyNDType(keys...),nullptr);
+	}
+
+
+	// thread-safe but slower version of get()
+	template<typename ... Keys>
+	inline
+	const CacheValue getThreadSafe(const Keys & ... keys)  noexcept
+	{
+		return accessDirectLocked(CacheKeyNDType(keys...),nullptr);
+	}
+
+	// set element to cache, row-major like C++ multi-dimensional arrays
+	// if cache doesn't find it in buffers,
+	// then cache sets data on just cache
+	// writing to backing-store only happens when
+	// 					another access evicts the cache slot containing this key/value
+	//					or when cache is flushed by flush() method
+	// then returns the given value back
+	// then cache is available from RAM on next get/set access with same key
+	// coordinates are given packed: set({x,y,z,w},value)
+	inline
+	void set(const CacheKeyNDType & key, const CacheValue & val) noexcept
+	{
+		accessDirect(key,&val,1);
+	}
+
+	// thread-safe but slower version of set()
+	inline
+	void setThreadSafe(const CacheKeyNDType & key, const CacheValue & val)  noexcept
+	{
+		accessDirectLocked(key,&val,1);
+	}
+
+	// use this before closing the backing-store to store the latest bits of data
+	// parallelism: number of threads that write edited tags (tiles) back in parallel (each takes a range of tags)
+	//				1 = calling thread only, 0 = std::thread::hardware_concurrency()
+	//				helper threads are started and joined by each call (see parallelFor in ParallelFor.h)
+	//				writeMiss (writeMissTile) is called from multiple threads when parallelism != 1
+	void flush(const int parallelism = 1)
+	{
+		try
+		{
+			parallelForChunks(numTiles,parallelism,[&](const size_t begin, const size_t end){
+				if(mut.size()>0)
+				{
+					for (size_t i=begin;i<end;i++)
+					{
+						std::lock_guard<std::mutex> lg(mut.of(i));
+						flushTile(i);
+					}
+				}
+				else
+				{
+					for (size_t i=begin;i<end;i++)
+					{
+						flushTile(i);
+					}
+				}
+			});
+		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
+	}
+
+	// attaches a stride-detecting prefetcher (see StridePrefetcher.h)
+	// 		after a cache-miss that continues a detected stride (row scan, column scan, raster order of an image/volume)
+	//		next "degree" elements (or tiles, in tiled mode) of the stream are loaded in same call, first hit on a prefetched batch loads next batch
+	//		thread-safe methods prefetch after releasing the lock of the missed slot and lock each prefetched slot on its own
+	// keyLimit: number of elements of backing-store per dimension (e.g. {width,height} of image), only keys in [0,keyLimit) are prefetched
+	// numStreams: number of concurrent scans tracked
+	// degree: number of elements (or tiles) loaded ahead per miss
+	// call before using the cache (not thread-safe)
+	void enablePrefetcher(const std::array<CacheKey,N> & keyLimit, const int numStreams=4, const int degree=4)
+	{
+		// streams are tracked in tile coordinates (tile = 1 element if not tiled)
+		CacheKeyNDType tileLimit;
+		for(size_t i=0;i<N;i++)
+			tileLimit.k[i] = (CacheKey)(((size_t)keyLimit[i] + tileM1[i]) >> tileBits[i]);
+		prefetcher = std::make_unique<StridePrefetcher<CacheKey,N>>(tileLimit,numStreams,degree);
+		prefetchedBuffer = std::vector<unsigned char>(numTiles,0);
+	}
+
+	// selects how "set" reaches backing-store (see CacheWritePolicy.h), default is WRITE_BACK
+	// 		WRITE_THROUGH: every set calls writeMiss, slots are never edited (flush has nothing to write)
+	//					tiled: the whole tile is written with writeMissTile after each set
+	// 		WRITE_AROUND: set of a key that is not cached calls writeMiss without evicting a slot
+	//					tiled: tile of the key is read into a temporary tile, updated and written back with readMissTile/writeMissTile
+	// call before using the cache (not thread-safe)
+	void enableWritePolicy(const CacheWritePolicy policy)
+	{
+		writePolicy = policy;
+	}
+
+	// direct mapped cache element access, locked per item for parallelism
+	// opType=0: get
+	// opType=1: set
+	CacheValue const accessDirectLocked(const CacheKeyNDType & key,const CacheValue * value, const bool opType = 0)
+	{
+		if(prefetcher)
+		{
+			// prefetching is done after the lock is released, so that it can lock other slots
+			const size_t index = indexOf(key);
+			bool miss;
+			bool prefetched;
+			CacheValue result;
+			{
+				std::lock_guard<std::mutex> lg(mut.of(index));
+				miss = !isResident(index,key);
+				prefetched = prefetchedBuffer[index];
+				result = accessResolved(index,key,value,opType);
+				prefetchedBuffer[index]=0;
+			}
+			if(miss || prefetched)
+				prefetchAfterAccess(key,index,miss,true);
+			return result;
+		}
+
+		if(tiled)
+		{
+			const size_t index = slotOf(tileOf(key));
+			std::lock_guard<std::mutex> lg(mut.of(index));
+			return accessTile(index,key,value,opType);
+		}
+		const size_t index = slotOf(key);
+		std::lock_guard<std::mutex> lg(mut.of(index)); // N parallel locks in-flight = less contention in multi-threading
+		return accessSlot(index,key,value,opType);
+	}
+
+	// direct mapped cache element access
+	// opType=0: get
+	// opType=1: set
+	CacheValue const accessDirect(const CacheKeyNDType & key,const CacheValue * value, const bool opType = 0)
+	{
+		if(prefetcher)
+		{
+			const size_t index = indexOf(key);
+			const bool miss = !isResident(index,key);
+			const bool prefetched = prefetchedBuffer[index];
+			const CacheValue result = accessResolved(index,key,value,opType);
+			prefetchedBuffer[index]=0;
+			if(miss || prefetched)
+				prefetchAfterAccess(key,index,miss,false);
+			return result;
+		}
+
+		if(tiled)
+			return accessTile(slotOf(tileOf(key)),key,value,opType);
+		return accessSlot(slotOf(key),key,value,opType);
+	}
+
+	// stencil gather: out[p] = get(center + pattern[p]) for each point p of pattern
+	// pattern: coordinate offsets, e.g. 5-point 2D: {{0,0},{-1,0},{1,0},{0,-1},{0,1}}
+	inline
+	void getStencil(const CacheKeyNDType & center, const std::vector<std::array<int,N>> & pattern, CacheValue * out)
+	{
+		accessMany(pattern.size(),[&](const size_t p){ return offsetKey(center,pattern[p]); },out,nullptr,0,false);
+	}
+
+	// thread-safe version of getStencil()
+	// all slots of the stencil are resolved first, then each needed lock is taken once (in increasing order, so no deadlock between stencils)
+	inline
+	void getStencilThreadSafe(const CacheKeyNDType & center, const std::vector<std::array<int,N>> & pattern, CacheValue * out)
+	{
+		accessMany(pattern.size(),[&](const size_t p){ return offsetKey(center,pattern[p]); },out,nullptr,0,true);
+	}
+
+	// span gather: out[i] = get(start + i along dimension) for i in [0,n)
+	inline
+	void getSpan(const CacheKeyNDType & start, const size_t dimension, const size_t n, CacheValue * out)
+	{
+		accessMany(n,[&](const size_t i){ return spanKey(start,dimension,i); },out,nullptr,0,false);
+	}
+
+	// thread-safe version of getSpan(), each needed lock is taken once
+	inline
+	void getSpanThreadSafe(const CacheKeyNDType & start, const size_t dimension, const size_t n, CacheValue * out)
+	{
+		accessMany(n,[&](const size_t i){ return spanKey(start,dimension,i); },out,nullptr,0,true);
+	}
+
+	// span scatter: set(start + i along dimension, in[i]) for i in [0,n)
+	inline
+	void setSpan(const CacheKeyNDType & start, const size_t dimension, const size_t n, const CacheValue * in)
+	{
+		accessMany(n,[&](const size_t i){ return spanKey(start,dimension,i); },nullptr,in,1,false);
+	}
+
+	// thread-safe version of setSpan(), each needed lock is taken once
+	inline
+	void setSpanThreadSafe(const CacheKeyNDType & start, const size_t dimension, const size_t n, const CacheValue * in)
+	{
+		accessMany(n,[&](const size_t i){ return spanKey(start,dimension,i); },nullptr,in,1,true);
+	}
+
+protected:
+	inline
+	static CacheKeyNDType offsetKey(const CacheKeyNDType & center, const std::array<int,N> & offset) noexcept
+	{
+		CacheKeyNDType result = center;
+		for(size_t i=0;i<N;i++)
+			result.k[i] += (CacheKey)offset[i];
+		return result;
+	}
+
+	inline
+	static CacheKeyNDType spanKey(const CacheKeyNDType & start, const size_t dimension, const size_t i) noexcept
+	{
+		CacheKeyNDType result = start;
+		result.k[dimension] += (CacheKey)i;
+		return result;
+	}
+
+	// slot index of a key (or index of its tile in tiled mode), locked by mut.of(index)
+	inline
+	size_t indexOf(const CacheKeyNDType & key) const noexcept
+	{
+		return tiled ? slotOf(tileOf(key)) : slotOf(key);
+	}
+
+	// n accesses in one pass, keyAt(i) gives i-th key
+	// opType=0: out[i] = get(keyAt(i))
+	// opType=1: set(keyAt(i),in[i])
+	// locked: all distinct locks of the n keys are acquired once in increasing order before the accesses
+	template<typename KeyGenerator>
+	void accessMany(const size_t n, const KeyGenerator & keyAt, CacheValue * out, const CacheValue * in, const bool opType, const bool locked)
+	{
+		if(!locked || mut.size()==0)
+		{
+			for(size_t i=0;i<n;i++)
+			{
+				if(opType==0)
+					out[i]=accessDirect(keyAt(i),nullptr);
+				else
+					accessDirect(keyAt(i),in+i,1);
+			}
+			return;
+		}
+
+		// no allocation for small stencils/spans
+		size_t localLocks[64];
+		std::vector<size_t> heapLocks;
+		size_t * locks = localLocks;
+		if(n>64)
+		{
+			heapLocks.resize(n);
+			locks = heapLocks.data();
+		}
+
+		for(size_t i=0;i<n;i++)
+			locks[i]=mut.stripeOf(indexOf(keyAt(i)));
+		std::sort(locks,locks+n);
+		const size_t numLocks = std::unique(locks,locks+n)-locks;
+
+		// missed keys (and first hits on prefetched tiles) are given to prefetcher after locks are released
+		std::vector<std::pair<CacheKeyNDType,bool>> observedKeys;
+
+		for(size_t l=0;l<numLocks;l++)
+			mut.stripe(locks[l]).lock();
+		try
+		{
+			for(size_t i=0;i<n;i++)
+			{
+				const CacheKeyNDType key = keyAt(i);
+				const size_t index = indexOf(key);
+				if(prefetcher)
+				{
+					const bool miss = !isResident(index,key);
+					if(miss || prefetchedBuffer[index])
+						observedKeys.emplace_back(key,miss);
+					prefetchedBuffer[index]=0;
+				}
+				if(opType==0)
+					out[i]=accessResolved(index,key,nullptr,0);
+				else
+					accessResolved(index,key,in+i,1);
+			}
+		}
+		catch(...)
+		{
+			for(size_t l=numLocks;l>0;l--)
+				mut.stripe(locks[l-1]).unlock();
+			throw;
+		}
+		for(size_t l=numLocks;l>0;l--)
+			mut.stripe(locks[l-1]).unlock();
+
+		for(const auto & observed:observedKeys)
+			prefetchAfterAccess(observed.first,indexOf(observed.first),observed.second,true);
+	}
+
+	// tiled or element-granular access after slot/tile is selected (and locked, if thread-safe)
+	inline
+	CacheValue const accessResolved(const size_t index, const CacheKeyNDType & key,const CacheValue * value, const bool opType)
+	{
+		if(tiled)
+			return accessTile(index,key,value,opType);
+		return accessSlot(index,key,value,opType);
+	}
+
+	// true if key's element (or tile) is in the slot
+	inline
+	bool isResident(const size_t index, const CacheKeyNDType & key) const noexcept
+	{
+		if(tiled)
+			return keyBuffer[index] == tileOriginOf(key);
+		return keyBuffer[index] == key;
+	}
+
+	// feeds a cache-miss key (or first hit on a prefetched element/tile) to prefetcher (in tile coordinates) and loads the predicted elements/tiles
+	// locked: prefetcher state is guarded by its own mutex (skipped if another thread is prefetching) and each predicted slot is locked separately
+	void prefetchAfterAccess(const CacheKeyNDType & key, const size_t demandIndex, const bool miss, const bool locked)
+	{
+		std::unique_lock<std::mutex> lck(prefetcherMut,std::defer_lock);
+		if(locked && !lck.try_lock())
+			return;
+
+		const auto prefetchFunc = [&](const CacheKeyNDType & nextTile){
+			if(locked)
+			{
+				std::lock_guard<std::mutex> lg(mut.of(slotOf(nextTile)));
+				prefetch(nextTile,demandIndex);
+			}
+			else
+				prefetch(nextTile,demandIndex);
+		};
+		if(miss)
+			prefetcher->onMiss(tileOf(key),prefetchFunc);
+		else
+			prefetcher->onPrefetchHit(tileOf(key),prefetchFunc);
+	}
+
+	// loads an element (or a whole tile) into its slot if it is not there, writes evicted edited data back
+	// slot of the demand access (demandIndex) is not touched
+	// slot is marked so that its first hit is reported to prefetcher, a marked (not yet used) slot is not evicted by another prefetch
+	inline
+	void prefetch(const CacheKeyNDType & tileKey, const size_t demandIndex)
+	{
+		const size_t index = slotOf(tileKey);
+		if(index == demandIndex || prefetchedBuffer[index])
+			return;
+
+		CacheKeyNDType origin;
+		for(size_t i=0;i<N;i++)
+			origin.k[i] = (CacheKey)(tileKey.k[i] << tileBits[i]);
+		if(keyBuffer[index] == origin)
+			return;
+
+		flushTile(index);
+		if(tiled)
+			loadTile(origin,valueBuffer.data() + (index<<tileVolumeBits));
+		else
+			valueBuffer[index]=load(origin);
+		keyBuffer[index]=origin;
+		prefetchedBuffer[index]=1;
+	}
+
+	// computes masks & shifts of tile grid (1x1x.. tiles = element-granular cache) and allocates buffers
+	void initialize(const std::array<CacheKey,N> & numElements, const std::array<CacheKey,N> & tileElements, const bool prepareForMultithreading, const size_t numLockStripes)
+	{
+		// row-major: last dimension is the fastest changing one (both for tiles in cache and for elements in tile)
+		numTiles = 1;
+		tileVolume = 1;
+		size_t bits[N];
+		for(size_t i=N;i>0;i--)
+		{
+			const size_t tileSize = tileElements[i-1];
+			const size_t gridSize = (size_t)numElements[i-1]/tileSize;
+			tileM1[i-1]=tileSize-1;
+			tileBits[i-1]=log2(tileSize);
+			tileShift[i-1]=log2(tileVolume);
+			tileVolume *= tileSize;
+
+			sizeM1[i-1]=gridSize-1;
+			shift[i-1]=log2(numTiles);
+			bits[i-1]=log2(gridSize);
+			numTiles *= gridSize;
+			depositMask[i-1] = ((size_t)sizeM1[i-1])<<shift[i-1];
+		}
+		tileVolumeBits = log2(tileVolume);
+		numSlots = numTiles*tileVolume;
+
+		// Morton order: bit r of each tag goes to next free bit position, round-robin over dimensions (last dimension first)
+		// dimensions with fewer bits simply drop out of the interleaving
+		if(zOrder)
+		{
+			size_t position = 0;
+			for(size_t i=0;i<N;i++)
+				depositMask[i]=0;
+			for(size_t r=0;position<64;r++)
+			{
+				bool any = false;
+				for(size_t i=N;i>0;i--)
+				{
+					if(r<bits[i-1])
+					{
+						depositMask[i-1] |= ((size_t)1)<<position;
+						position++;
+						any = true;
+					}
+				}
+				if(!any)
+					break;
+			}
+		}
+
+		// locks, keys and dirty flags are per tile, values are per element
+		if(prepareForMultithreading)
+			mut = StripedLockTable(numTiles,numLockStripes);
+		// initialize buffers
+		valueBuffer.reserve(numSlots);
+		isEditedBuffer.reserve(numTiles);
+		keyBuffer.reserve(numTiles);
+		for(size_t i=0;i<numSlots;i++)
+		{
+			valueBuffer.push_back(CacheValue());
+		}
+		for(size_t i=0;i<numTiles;i++)
+		{
+			isEditedBuffer.push_back(0);
+			keyBuffer.push_back(CacheKeyNDType());
+		}
+	}
+
+	static size_t log2(const size_t n) noexcept
+	{
+		size_t result = 0;
+		while(((size_t)1<<result) < n)
+			result++;
+		return result;
+	}
+
+	// tile coordinates of an element (=key itself for element-granular cache)
+	inline
+	CacheKeyNDType tileOf(const CacheKeyNDType & key) const noexcept
+	{
+		CacheKeyNDType result;
+		for(size_t i=0;i<N;i++)
+			result.k[i] = key.k[i] >> tileBits[i];
+		return result;
+	}
+
+	// first element of the tile that contains key
+	inline
+	CacheKeyNDType tileOriginOf(const CacheKeyNDType & key) const noexcept
+	{
+		CacheKeyNDType result;
+		for(size_t i=0;i<N;i++)
+			result.k[i] = key.k[i] & ~((CacheKey)tileM1[i]);
+		return result;
+	}
+
+	// row-major element offset inside its tile
+	inline
+	size_t offsetInTile(const CacheKeyNDType & key) const noexcept
+	{
+		size_t result = 0;
+		for(size_t i=0;i<N;i++)
+			result |= ((size_t)(key.k[i] & tileM1[i])) << tileShift[i];
+		return result;
+	}
+
+	// writes tile/element back to backing-store if edited, caller locks
+	inline
+	void flushTile(const size_t index)
+	{
+		if (isEditedBuffer[index] == 1)
+		{
+			isEditedBuffer[index]=0;
+			if(tiled)
+			{
+				saveTile(keyBuffer[index],valueBuffer.data() + (index<<tileVolumeBits));
+			}
+			else
+			{
+				auto oldKey = keyBuffer[index];
+				auto oldValue = valueBuffer[index];
+				save(oldKey,oldValue);
+			}
+		}
+	}
+
+	// slot index of a key
+	// row-major: sizes are powers of 2 so tagX*sizeY*sizeZ + tagY*sizeZ + tagZ = (tagX<<shiftX) | (tagY<<shiftY) | tagZ
+	// Z-order: bits of each tag are deposited into its interleaved bit positions
+	// (row-major is also a deposit into contiguous bit positions so with BMI2 both layouts use same instructions)
+	inline
+	size_t slotOf(const CacheKeyNDType & key) const noexcept
+	{
+#if defined(__BMI2__)
+		return slotOfDeposit(key,std::make_index_sequence<N>());
+#else
+		if(zOrder)
+			return slotOfDeposit(key,std::make_index_sequence<N>());
+		return slotOf(key,std::make_index_sequence<N>());
+#endif
+	}
+
+	template<size_t ... I>
+	inline
+	size_t slotOf(const CacheKeyNDType & key, std::index_sequence<I...>) const noexcept
+	{
+		return ( ( ((size_t)(key.k[I] & sizeM1[I])) << shift[I] ) | ... );
+	}
+
+	template<size_t ... I>
+	inline
+	size_t slotOfDeposit(const CacheKeyNDType & key, std::index_sequence<I...>) const noexcept
+	{
+		return ( depositBits((size_t)key.k[I],depositMask[I]) | ... );
+	}
+
+	// scatters low bits of value into set bits of mask (same as BMI2 pdep)
+	static inline
+	size_t depositBits(size_t value, size_t mask) noexcept
+	{
+#if defined(__BMI2__)
+		return (size_t)_pdep_u64((unsigned long long)value,(unsigned long long)mask);
+#else
+		size_t result = 0;
+		while(mask)
+		{
+			const size_t lowest = mask & (~mask + 1);
+			if(value & 1)
+				result |= lowest;
+			value >>= 1;
+			mask ^= lowest;
+		}
+		return result;
+#endif
+	}
+
+	inline
+	CacheValue load(const CacheKeyNDType & key)
+	{
+		return load(key,std::make_index_sequence<N>());
+	}
+
+	template<size_t ... I>
+	inline
+	CacheValue load(const CacheKeyNDType & key, std::index_sequence<I...>)
+	{
+		return loadData(key.k[I]...);
+	}
+
+	inline
+	void save(const CacheKeyNDType & key, const CacheValue & value)
+	{
+		save(key,value,std::make_index_sequence<N>());
+	}
+
+	template<size_t ... I>
+	inline
+	void save(const CacheKeyNDType & key, const CacheValue & value, std::index_sequence<I...>)
+	{
+		saveData(key.k[I]...,value);
+	}
+
+	inline
+	void loadTile(const CacheKeyNDType & origin, CacheValue * tile)
+	{
+		loadTile(origin,tile,std::make_index_sequence<N>());
+	}
+
+	template<size_t ... I>
+	inline
+	void loadTile(const CacheKeyNDType & origin, CacheValue * tile, std::index_sequence<I...>)
+	{
+		loadTileData(origin.k[I]...,tile);
+	}
+
+	inline
+	void saveTile(const CacheKeyNDType & origin, const CacheValue * tile)
+	{
+		saveTile(origin,tile,std::make_index_sequence<N>());
+	}
+
+	template<size_t ... I>
+	inline
+	void saveTile(const CacheKeyNDType & origin, const CacheValue * tile, std::index_sequence<I...>)
+	{
+		saveTileData(origin.k[I]...,tile);
+	}
+
+	// tiled cache access after tile is selected (and locked, if thread-safe)
+	// tile-miss: edited tile is written back as a whole, then the new tile is loaded as a whole (also for "set", to keep rest of the tile valid)
+	inline
+	CacheValue const accessTile(const size_t index, const CacheKeyNDType & key,const CacheValue * value, const bool opType)
+	{
+		const CacheKeyNDType origin = tileOriginOf(key);
+		CacheValue * const tile = valueBuffer.data() + (index<<tileVolumeBits);
+		if(opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND && !(keyBuffer[index] == origin))
+		{
+			// bypass: cached tile stays, rest of the written tile is kept by read-modify-write
+			std::vector<CacheValue> bypassTile(tileVolume);
+			loadTile(origin,bypassTile.data());
+			bypassTile[offsetInTile(key)]=*value;
+			saveTile(origin,bypassTile.data());
+			return *value;
+		}
+
+		if(!(keyBuffer[index] == origin))
+		{
+			// cache-miss
+			if(isEditedBuffer[index] == 1)
+			{
+				isEditedBuffer[index]=0;
+				saveTile(keyBuffer[index],tile);
+			}
+			loadTile(origin,tile);
+			keyBuffer[index]=origin;
+		}
+
+		const size_t offset = offsetInTile(key);
+
+		// "set"
+		if(opType == 1)
+		{
+			tile[offset]=*value;
+			if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+				saveTile(origin,tile);
+			else
+				isEditedBuffer[index]=1;
+		}
+		return tile[offset];
+	}
+
+	// cache access after slot is selected (and locked, if thread-safe)
+	inline
+	CacheValue const accessSlot(const size_t index, const CacheKeyNDType & key,const CacheValue * value, const bool opType)
+	{
+		// compare keys
+		const CacheKeyNDType oldKey = keyBuffer[index];
+		if(oldKey == key)
+		{
+			// cache-hit
+
+			// "set"
+			if(opType == 1)
+			{
+				isEditedBuffer[index]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
+				valueBuffer[index]=*value;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					save(key,*value);
+			}
+
+			// cache hit value
+			return valueBuffer[index];
+		}
+		else if(opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND)
+		{
+			// bypass: slot keeps its item
+			save(key,*value);
+			return *value;
+		}
+		else // cache-miss
+		{
+			CacheValue oldValue = valueBuffer[index];
+
+			// eviction algorithm start
+			if(isEditedBuffer[index] == 1)
+			{
+				// if it is "get"
+				if(opType==0)
+				{
+					isEditedBuffer[index]=0;
+				}
+
+				save(oldKey,oldValue);
+			}
+			else if(opType == 1) // "set" on not edited
+			{
+				isEditedBuffer[index]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
+			}
+
+			// "get"
+			if(opType==0)
+			{
+				const CacheValue && loadedData = load(key);
+				valueBuffer[index]=loadedData;
+				keyBuffer[index]=key;
+				return loadedData;
+			}
+			else /* "set" */
+			{
+				valueBuffer[index]=*value;
+				keyBuffer[index]=key;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+				{
+					isEditedBuffer[index]=0;
+					save(key,*value);
+				}
+				return *value;
+			}
+		}
+	}
+
+	CacheKey sizeM1[N];
+	size_t shift[N];
+	size_t depositMask[N];
+	size_t numSlots;
+	size_t numTiles;
+	CacheKey tileM1[N];
+	size_t tileBits[N];
+	size_t tileShift[N];
+	size_t tileVolume;
+	size_t tileVolumeBits;
+	const bool zOrder;
+	const bool tiled;
+	CacheWritePolicy writePolicy;
+
+	StripedLockTable mut;
+	std::vector<CacheValue> valueBuffer;
+	std::vector<unsigned char> isEditedBuffer;
+	std::vector<CacheKeyNDType> keyBuffer;
+
+	const ReadMissFunctionND<CacheKey,CacheValue,N>  loadData;
+	const WriteMissFunctionND<CacheKey,CacheValue,N>  saveData;
+	const ReadTileFunctionND<CacheKey,CacheValue,N>  loadTileData;
+	const WriteTileFunctionND<CacheKey,CacheValue,N>  saveTileData;
+
+	std::unique_ptr<StridePrefetcher<CacheKey,N>> prefetcher;
+	std::vector<unsigned char> prefetchedBuffer;
+	std::mutex prefetcherMut;
+};
+
+
+#endif /* DIRECTMAPPEDNDCACHE_H_ */
@@ -0,0 +1,93 @@
+/*
+ * InsertionFilter.h
+ *
+ *  Created on: Nov 17, 2021
+ *      Author: tugrul
+ */
+
+#ifndef INSERTIONFILTER_H_
+#define INSERTIONFILTER_H_
+
+#include<memory>
+#include<mutex>
+#include<atomic>
+#include<limits>
+#include<cstdint>
+#include"StridePrefetcher.h"
+#include"KeyMixer.h"
+
+// which cache-misses of a front-end (L1) cache install the key into the cache
+// ALWAYS: 			every miss (default behavior of caches)
+// SECOND_ACCESS: 	a key is installed on its second miss within a short history, first miss is served from next level without evicting anything
+//					(a key that is used only once, as in a bulk scan, never evicts a hot key)
+// STREAM_BYPASS: 	misses that continue a detected sequential/strided scan (see StridePrefetcher.h) are served from next level without installing
+enum class CacheInsertionPolicy
+{
+	ALWAYS,
+	SECOND_ACCESS,
+	STREAM_BYPASS
+};
+
+/* admission decision for cache-misses of a direct-mapped cache
+ * history of SECOND_ACCESS: historySize fingerprints of recently missed keys (4 bytes each), a fingerprint is cleared when its key is admitted
+ * 		collisions only change which keys are admitted early or late, never the data
+ * thread-safe: history uses relaxed atomics, stream detector is used by one thread at a time (a thread that finds it busy admits its key)
+ */
+template<typename CacheKey>
+class InsertionFilter
+{
+public:
+	InsertionFilter(const CacheInsertionPolicy insertionPolicy, const size_t historySize = 1024*4, const int numStreams = 4):
+		policy(insertionPolicy),historyM1(0),
+		streams(CacheKeyND<CacheKey,1>(std::numeric_limits<CacheKey>::max()),numStreams,0)
+	{
+		if(policy == CacheInsertionPolicy::SECOND_ACCESS)
+		{
+			size_t size = 1;
+			while(size < historySize)
+				size <<= 1;
+			historyM1 = size - 1;
+			history = std::unique_ptr<std::atomic<uint32_t>[]>(new std::atomic<uint32_t>[size]);
+			for(size_t i=0;i<size;i++)
+				history[i].store(0,std::memory_order_relaxed);
+		}
+	}
+
+	// called on a cache-miss of key, returns true if key is to be installed
+	inline
+	bool admit(const CacheKey & key)
+	{
+		if(policy == CacheInsertionPolicy::SECOND_ACCESS)
+		{
+			const size_t hash = hasher(key);
+			const uint32_t fingerprint = (uint32_t)((uint64_t)hash >> 32) | 1;
+			std::atomic<uint32_t> & entry = history[hash & historyM1];
+			if(entry.load(std::memory_order_relaxed) == fingerprint)
+			{
+				entry.store(0,std::memory_order_relaxed);
+				return true;
+			}
+			entry.store(fingerprint,std::memory_order_relaxed);
+			return false;
+		}
+
+		if(policy == CacheInsertionPolicy::STREAM_BYPASS)
+		{
+			std::unique_lock<std::mutex> lock(streamMut,std::try_to_lock);
+			if(!lock.owns_lock())
+				return true;
+			return !streams.onMiss(CacheKeyND<CacheKey,1>(key),[](const CacheKeyND<CacheKey,1> &){ });
+		}
+		return true;
+	}
+private:
+	const CacheInsertionPolicy policy;
+	size_t historyM1;
+	std::unique_ptr<std::atomic<uint32_t>[]> history;
+	std::mutex streamMut;
+	StridePrefetcher<CacheKey,1> streams;
+	IntegerKeyMixer<CacheKey> hasher;
+};
+
+
+#endif /* INSERTIONFILTER_H_ */
@@ -0,0 +1,42 @@
+/*
+ * KeyMixer.h
+ *
+ *  Created on: Nov 12, 2021
+ *      Author: tugrul
+ */
+
+#ifndef KEYMIXER_H_
+#define KEYMIXER_H_
+
+#include<functional>
+#include<type_traits>
+#include<cstdint>
+
+/* default key hasher of hashed caches (NWaySetAssociativeMultiThreadCache)
+ * integer keys: all bits are mixed (64-bit finalizer of MurmurHash3) so low bits of result depend on all bits of key
+ * 		strided keys (0,64,128,...) that would select same set with (key & mask) are spread over all sets
+ * other keys (std::string, ...): result of std::hash is mixed the same way (std::hash of integers is identity on common standard libraries)
+ * any other hasher with "size_t operator()(const CacheKey &) const" can be used instead, for example std::hash<std::string>
+ */
+template<typename CacheKey>
+struct IntegerKeyMixer
+{
+	inline
+	size_t operator()(const CacheKey & key) const noexcept
+	{
+		uint64_t h;
+		if constexpr (std::is_integral<CacheKey>::value || std::is_enum<CacheKey>::value)
+			h = (uint64_t)key;
+		else
+			h = (uint64_t)std::hash<CacheKey>()(key);
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdull;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ull;
+		h ^= h >> 33;
+		return (size_t)h;
+	}
+};
+
+
+#endif /* KEYMIXER_H_ */
@@ -11,7 +11,17 @@
 #include<vector>
 #include<memory>
 #include<functional>
-#include"../LruClockCache.h"
+#include<mutex>
+#include<atomic>
+#include<algorithm>
+#include<numeric>
+#include<limits>
+#include<cstdint>
+#include<iostream>
+#include"ParallelFor.h"
+#include"KeyMixer.h"
+#include"../LockProfiler.h"
+#include"../CacheWritePolicy.h"
 
 /* N parallel LRU approximations (Clock Second Chance)
 * Each with own mutex
@@ -22,78 +32,759 @@
 * numberOfTagsPerLRU = number of cache items per set (LRU Clock cache)
 * 			total size of cache is (numberOfSets * numberOfTagsPerLRU) elements
 * ClockHandInteger: just an optional optimization to reduce memory consumption when cache size is equal to or less than 255,65535,4B-1,...
+* 			(numberOfTagsPerLRU has to fit in it, it is also the element type of per-set hash index)
+* CacheKeyHasher: hash of key selects the set (low bits) and position in index of the set (higher bits)
+* 			default IntegerKeyMixer mixes all bits of integer keys so strided keys do not pile into few sets (and few locks)
+* 			any key type with std::hash and operator== works too, e.g. NWaySetAssociativeMultiThreadCache<std::string,Obj>
+* 			or NWaySetAssociativeMultiThreadCache<std::string,Obj,size_t,std::hash<std::string>> (std::hash result is used as it is)
+* 			std::hash<integer> (identity on common standard libraries) gives old (key & mask) selection: best for dense key ranges, worst for strided keys
+*
+* Storage is flat (no per-set objects): all sets share a few contiguous buffers, each set owns a contiguous range of them
+* 		set header:	mutex + 2 clock hands + range of set, 64-byte aligned (no false-sharing between sets)
+* 		slots:		key and value side by side (a hit reads 1 cache line for both)
+* 		flags:		second-chance, edited and valid bits in 1 byte per slot (clock hands scan only this)
+* 		index:		open-addressing hash table per set (linear probing, 2x slots) that maps key to slot, instead of std::unordered_map
+* 		read/write miss functions are stored once for the whole cache
+*
+* Optional capacity rebalancing (enableRebalancing): all sets start with numberOfTagsPerLRU tags, total number of tags never changes
+* 		each set remembers fingerprints of recently evicted keys (ghost), a miss on a ghost key means set would hit with more tags
+* 		rebalance() moves tags from sets with fewest ghost-hits to sets with most ghost-hits (skewed keys: hot sets grow, cold sets shrink)
+*
+* Optional resizing (enableResizing): resize() changes number of tags of all sets at run-time (total capacity changes, memory of slots follows it)
 */
 
-template<typename CacheKey, typename CacheValue, typename CacheHandInteger=size_t>
+template<typename CacheKey, typename CacheValue, typename CacheHandInteger=size_t, typename CacheKeyHasher=IntegerKeyMixer<CacheKey>>
 class NWaySetAssociativeMultiThreadCache
 {
 public:
 	NWaySetAssociativeMultiThreadCache(size_t numberOfSets, size_t numberOfTagsPerLRU,
 			const std::function<CacheValue(CacheKey)> & readMiss,
-			const std::function<void(CacheKey,CacheValue)> & writeMiss):numSet(numberOfSets),numSetM1(numberOfSets-1),numTag(numberOfTagsPerLRU)
+			const std::function<void(CacheKey,CacheValue)> & writeMiss):numSet(numberOfSets),numSetM1(numberOfSets-1),numTag(numberOfTagsPerLRU),
+			minTags(numberOfTagsPerLRU),maxTags(numberOfTagsPerLRU),rebalanceInterval(0),rebalancing(false),missCounter(0),rebalanceRequested(false),layoutVersion(0),ghostSize(1),loadData(readMiss),saveData(writeMiss),writePolicy(CacheWritePolicy::WRITE_BACK)
 	{
-
-		for(size_t i=0;i<numSet;i++)
-		{
-			sets.push_back(std::make_shared<LruClockCache<CacheKey,CacheValue,CacheHandInteger>>(numTag,readMiss,writeMiss));
-		}
+		initialize();
 	}
 
 	// allocates 64k tags per set (1024 sets = 64M cache size)
 	NWaySetAssociativeMultiThreadCache(size_t numberOfSets,
 			const std::function<CacheValue(CacheKey)> & readMiss,
-			const std::function<void(CacheKey,CacheValue)> & writeMiss):numSet(numberOfSets),numSetM1(numberOfSets-1),numTag(1024*64)
+			const std::function<void(CacheKey,CacheValue)> & writeMiss):numSet(numberOfSets),numSetM1(numberOfSets-1),numTag(1024*64),
+			minTags(1024*64),maxTags(1024*64),rebalanceInterval(0),rebalancing(false),missCounter(0),rebalanceRequested(false),layoutVersion(0),ghostSize(1),loadData(readMiss),saveData(writeMiss),writePolicy(CacheWritePolicy::WRITE_BACK)
 	{
-
-		for(size_t i=0;i<numSet;i++)
-		{
-			sets.push_back(std::make_shared<LruClockCache<CacheKey,CacheValue,CacheHandInteger>>(numTag,readMiss,writeMiss));
-		}
+		initialize();
 	}
 
 	inline
-	const CacheValue get(CacheKey key) const noexcept
+	const CacheValue get(const CacheKey & key) noexcept
 	{
 		// select set
-		CacheKey set = key & numSetM1;
-		return sets[set]->get(key);
+		const size_t hash = hasher(key);
+		const CacheValue result = accessClock2Hand(hash & numSetM1,hash,key,nullptr,0,loadData,saveData);
+		rebalanceIfRequested();
+		return result;
 	}
 
 	inline
-	void set(CacheKey key, CacheValue value) const noexcept
+	void set(const CacheKey & key, const CacheValue & value) noexcept
 	{
 		// select set
-		CacheKey set = key & numSetM1;
-		sets[set]->set(key,value);
+		const size_t hash = hasher(key);
+		accessClock2Hand(hash & numSetM1,hash,key,&value,1,loadData,saveData);
+		rebalanceIfRequested();
 	}
 
-	const CacheValue getThreadSafe(CacheKey key) const noexcept
+	const CacheValue getThreadSafe(const CacheKey & key) noexcept
 	{
 		// select set
-		CacheKey set = key & numSetM1;
-		return sets[set]->getThreadSafe(key);
+		const size_t hash = hasher(key);
+		const size_t set = hash & numSetM1;
+		CacheValue result;
+		{
+			ProfiledLockGuard<std::mutex> lg(header[set].mut,profiler,set);
+			result = accessClock2Hand(set,hash,key,nullptr,0,loadData,saveData);
+		}
+		rebalanceIfRequested();
+		return result;
 	}
 
-	void setThreadSafe(CacheKey key, CacheValue value) const noexcept
+	void setThreadSafe(const CacheKey & key, const CacheValue & value) noexcept
 	{
 		// select set
-		CacheKey set = key & numSetM1;
-		sets[set]->setThreadSafe(key,value);
+		const size_t hash = hasher(key);
+		const size_t set = hash & numSetM1;
+		{
+			ProfiledLockGuard<std::mutex> lg(header[set].mut,profiler,set);
+			accessClock2Hand(set,hash,key,&value,1,loadData,saveData);
+		}
+		rebalanceIfRequested();
+	}
+
+	// same as get/set but cache-misses call load(key) / save(key,value) instead of readMiss / writeMiss
+	// 		load and save are template parameters so that a lambda calling next cache level is inlined (see CacheHierarchy.h)
+	// 		items evicted by rebalance() and flush() are still written with writeMiss
+	// opType=0: get
+	// opType=1: set
+	template<typename Load, typename Save>
+	inline
+	const CacheValue accessWith(const CacheKey & key, const CacheValue * value, const bool opType, const Load & load, const Save & save)
+	{
+		const size_t hash = hasher(key);
+		const CacheValue result = accessClock2Hand(hash & numSetM1,hash,key,value,opType,load,save);
+		rebalanceIfRequested();
+		return result;
+	}
+
+	// thread-safe version of accessWith
+	template<typename Load, typename Save>
+	const CacheValue accessThreadSafeWith(const CacheKey & key, const CacheValue * value, const bool opType, const Load & load, const Save & save)
+	{
+		const size_t hash = hasher(key);
+		const size_t set = hash & numSetM1;
+		CacheValue result;
+		{
+			ProfiledLockGuard<std::mutex> lg(header[set].mut,profiler,set);
+			result = accessClock2Hand(set,hash,key,value,opType,load,save);
+		}
+		rebalanceIfRequested();
+		return result;
+	}
+
+	// exclusive hierarchy support (MultiLevelCache::enableExclusiveMode): moves an item out of cache
+	// returns false if key is not in cache (backing-store is not read)
+	// value: value of the item, dirty: true if item was edited and not written to backing-store yet (caller becomes responsible for writing it)
+	bool extractThreadSafe(const CacheKey & key, CacheValue & value, bool & dirty) noexcept
+	{
+		const size_t hash = hasher(key);
+		const size_t set = hash & numSetM1;
+		bool found;
+		{
+			ProfiledLockGuard<std::mutex> lg(header[set].mut,profiler,set);
+			found = extractSlot(set,hash,key,value,dirty);
+		}
+		rebalanceIfRequested();
+		return found;
+	}
+
+	// exclusive hierarchy support: moves an item (evicted from upper level, clean or edited) into cache without reading backing-store
+	// dirty: item is written to backing-store when it is evicted from this cache or flushed
+	void insertThreadSafe(const CacheKey & key, const CacheValue & value, const bool dirty) noexcept
+	{
+		const size_t hash = hasher(key);
+		const size_t set = hash & numSetM1;
+		{
+			ProfiledLockGuard<std::mutex> lg(header[set].mut,profiler,set);
+			insertSlot(set,hash,key,value,dirty);
+		}
+		rebalanceIfRequested();
+	}
+
+	// enables per-set capacity rebalancing, call before using the cache (not thread-safe, cache content is discarded)
+	// minTagsPerSet, maxTagsPerSet: limits of capacity of a set (total capacity stays numberOfSets * numberOfTagsPerLRU)
+	// 			maxTagsPerSet has to fit in CacheHandInteger, index of each set grows to 2 x maxTagsPerSet elements
+	// missesPerRebalance: rebalance() is called automatically after this many misses (in total), 0 = only manual rebalance() calls
+	void enableRebalancing(const size_t minTagsPerSet, const size_t maxTagsPerSet, const size_t missesPerRebalance = 0)
+	{
+		minTags = std::max(std::min(minTagsPerSet,numTag),(size_t)1);
+		maxTags = std::min(std::max(maxTagsPerSet,numTag),(size_t)std::numeric_limits<CacheHandInteger>::max());
+		rebalanceInterval = missesPerRebalance;
+		rebalancing = true;
+		initialize();
+	}
+
+	// allows resize() up to maxTagsPerSet tags per set, call before using the cache (not thread-safe, cache content is discarded)
+	// maxTagsPerSet has to fit in CacheHandInteger, index of each set grows to 2 x maxTagsPerSet elements
+	void enableResizing(const size_t maxTagsPerSet)
+	{
+		maxTags = std::min(std::max(maxTagsPerSet,maxTags),(size_t)std::numeric_limits<CacheHandInteger>::max());
+		initialize();
+	}
+
+	// selects how "set" reaches backing-store (see CacheWritePolicy.h), default is WRITE_BACK
+	// 		WRITE_THROUGH: every set calls writeMiss while its set is locked, items are never edited (flush has nothing to write)
+	// 		WRITE_AROUND: set of a key that is not cached calls writeMiss without evicting an item
+	// call before using the cache (not thread-safe)
+	void enableWritePolicy(const CacheWritePolicy policy)
+	{
+		writePolicy = policy;
+	}
+
+	// sets number of tags of every set to tagsPerSet (thread-safe, locks all sets, call rarely)
+	// tagsPerSet: clamped to [1, maxTagsPerSet of enableResizing]
+	// a shrinking set keeps its items with second-chance first, other items are evicted (written to backing-store if edited)
+	// per-set capacities of rebalancing are reset to the same value
+	// takes O(cache size) time and temporarily allocates a second copy of slots
+	void resize(const size_t tagsPerSet)
+	{
+		const size_t tags = std::min(std::max(tagsPerSet,(size_t)1),maxTags);
+		std::lock_guard<std::mutex> lgr(rebalanceMut);
+		for(size_t i=0;i<numSet;i++)
+			header[i].mut.lock();
+		try
+		{
+			relayout(std::vector<size_t>(numSet,tags));
+		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
+		for(size_t i=0;i<numSet;i++)
+			header[i].mut.unlock();
 	}
 
-	void flush()
+	// moves tags from sets with low miss-pressure to sets with high miss-pressure (thread-safe, locks all sets)
+	// a few pairs of sets exchange 1/8 of numberOfTagsPerLRU tags per call, ghost-hit counters decay by half after each call
+	// evicted items of a shrinking set are written to backing-store if edited
+	// takes O(cache size) time and temporarily allocates a second copy of slots, call rarely
+	void rebalance()
 	{
+		if(!rebalancing)
+			return;
+
+		std::lock_guard<std::mutex> lgr(rebalanceMut);
 		for(size_t i=0;i<numSet;i++)
+			header[i].mut.lock();
+		try
 		{
-			sets[i]->flush();
+			rebalanceLocked();
+		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
+		for(size_t i=0;i<numSet;i++)
+			header[i].mut.unlock();
+	}
+
+	// starts recording lock statistics per set (acquisitions, contention, wait/hold time histograms)
+	void enableLockProfiler()
+	{
+		profiler.enable(numSet);
+	}
+
+	// lock statistics per set, example: cache.getLockProfiler().report(std::cout,8,"set");
+	const LockProfiler & getLockProfiler() const
+	{
+		return profiler;
+	}
+
+	// current number of tags of each set
+	std::vector<size_t> capacities()
+	{
+		std::vector<size_t> result(numSet);
+		for(size_t i=0;i<numSet;i++)
+		{
+			ProfiledLockGuard<std::mutex> lg(header[i].mut,profiler,i);
+			result[i]=header[i].capacity;
 		}
+		return result;
+	}
+
+	// writes edited items of all sets back to backing-store, items stay in cache as clean
+	// can run while other threads use the cache: lock of a set is held for scanning flags and writing 1 edited item, then released
+	// 		every item that was edited before flush() started is written (by flush or by its eviction) before flush() returns
+	//		an item edited again after it was written stays edited for next flush
+	// parallelism: number of threads that flush sets in parallel (each takes a range of sets)
+	//				1 = calling thread only, 0 = std::thread::hardware_concurrency()
+	//				helper threads are started and joined by each call (see parallelFor in ParallelFor.h)
+	//				writeMiss is called from multiple threads when parallelism != 1
+	void flush(const int parallelism = 1)
+	{
+		parallelForChunks(numSet,parallelism,[&](const size_t begin, const size_t end){
+			for(size_t i=begin;i<end;i++)
+			{
+				flushSet(i);
+			}
+		});
 	}
 
 private:
-	const CacheKey numSet;
-	const CacheKey numSetM1;
-	const CacheKey numTag;
-	std::vector<std::shared_ptr<LruClockCache<CacheKey,CacheValue,CacheHandInteger>>> sets;
+	static constexpr unsigned char chanceBit = 1;
+	static constexpr unsigned char editedBit = 2;
+	static constexpr unsigned char validBit = 4;
+
+	struct alignas(64) SetHeader
+	{
+		SetHeader():ctr(0),ctrEvict(0),capacity(0),numFree(0),offset(0),ghostHits(0){ }
+		std::mutex mut;
+		CacheHandInteger ctr;
+		CacheHandInteger ctrEvict;
+		CacheHandInteger capacity;
+		CacheHandInteger numFree;
+		size_t offset;
+		size_t ghostHits;
+	};
+
+	struct Slot
+	{
+		CacheKey key;
+		CacheValue value;
+	};
+
+	void initialize()
+	{
+		indexSize = 1;
+		while(indexSize < 2*maxTags)
+			indexSize <<= 1;
+		indexSizeM1 = indexSize - 1;
+		setShift = 0;
+		while(((size_t)1<<setShift) < numSet)
+			setShift++;
+		emptyIndex = (CacheHandInteger)maxTags;
+
+		header = std::unique_ptr<SetHeader[]>(new SetHeader[numSet]);
+		for(size_t i=0;i<numSet;i++)
+		{
+			header[i].capacity = (CacheHandInteger)numTag;
+			header[i].offset = i*numTag;
+			// 50% phase difference between eviction and second-chance hands of the "second-chance" CLOCK algorithm
+			header[i].ctrEvict = (CacheHandInteger)(numTag/2);
+		}
+		slotBuffer = std::vector<Slot>((size_t)numSet*numTag,Slot{CacheKey(),CacheValue()});
+		flagBuffer = std::vector<unsigned char>((size_t)numSet*numTag,0);
+		freeBuffer = std::vector<CacheHandInteger>((size_t)numSet*numTag,0);
+		indexBuffer = std::vector<CacheHandInteger>((size_t)numSet*indexSize,emptyIndex);
+
+		if(rebalancing)
+		{
+			ghostSize = 1;
+			while(ghostSize < numTag)
+				ghostSize <<= 1;
+			ghostBuffer = std::vector<uint32_t>(numSet*ghostSize,0);
+		}
+	}
+
+	// position and fingerprint of a key in ghost table of its set (0 = empty)
+	inline
+	size_t ghostOf(const size_t hash) const noexcept
+	{
+		return (hash >> setShift) & (ghostSize-1);
+	}
+
+	static inline
+	uint32_t fingerprintOf(const size_t hash) noexcept
+	{
+		return (uint32_t)(((uint64_t)hash >> 32) ^ (uint64_t)hash) | 1;
+	}
+
+	// home position of a key in index of its set
+	// low bits of hash select the set, so the bits above them select the position
+	inline
+	size_t homeOf(const size_t hash) const noexcept
+	{
+		return (hash >> setShift) & indexSizeM1;
+	}
+
+	// slot index of key in set, or emptyIndex
+	inline
+	CacheHandInteger find(const size_t set, const size_t hash, const CacheKey & key) const noexcept
+	{
+		const CacheHandInteger * const index = indexBuffer.data() + set*indexSize;
+		const Slot * const slots = slotBuffer.data() + header[set].offset;
+		size_t pos = homeOf(hash);
+		while(true)
+		{
+			const CacheHandInteger slot = index[pos];
+			if(slot == emptyIndex || slots[slot].key == key)
+				return slot;
+			pos = (pos+1) & indexSizeM1;
+		}
+	}
+
+	inline
+	void insertIndex(const size_t set, const size_t hash, const CacheHandInteger slot) noexcept
+	{
+		CacheHandInteger * const index = indexBuffer.data() + set*indexSize;
+		size_t pos = homeOf(hash);
+		while(index[pos] != emptyIndex)
+			pos = (pos+1) & indexSizeM1;
+		index[pos] = slot;
+	}
+
+	// removes slot from index of set, with backward-shift (no tombstones, probe chains stay short)
+	inline
+	void eraseIndex(const size_t set, const size_t hash, const CacheHandInteger slot) noexcept
+	{
+		CacheHandInteger * const index = indexBuffer.data() + set*indexSize;
+		const Slot * const slots = slotBuffer.data() + header[set].offset;
+		size_t hole = homeOf(hash);
+		while(index[hole] != slot)
+			hole = (hole+1) & indexSizeM1;
+
+		size_t pos = hole;
+		while(true)
+		{
+			pos = (pos+1) & indexSizeM1;
+			const CacheHandInteger moved = index[pos];
+			if(moved == emptyIndex)
+				break;
+
+			// element at pos can fill the hole only if its home position is not in (hole,pos]
+			const size_t home = homeOf(hasher(slots[moved].key));
+			const bool homeBetween = (hole<=pos) ? (hole<home && home<=pos) : (hole<home || home<=pos);
+			if(!homeBetween)
+			{
+				index[hole] = moved;
+				hole = pos;
+			}
+		}
+		index[hole] = emptyIndex;
+	}
+
+	// same as LruClockCache::accessClock2Hand, on the buffers of a set
+	// CLOCK algorithm with 2 hand counters (1 for second chance for a cache slot to survive, 1 for eviction of cache slot)
+	// opType=0: get
+	// opType=1: set
+	template<typename Load, typename Save>
+	CacheValue const accessClock2Hand(const size_t set, const size_t hash, const CacheKey & key, const CacheValue * value, const bool opType,
+			const Load & loadData, const Save & saveData)
+	{
+		SetHeader & hands = header[set];
+		Slot * const slots = slotBuffer.data() + hands.offset;
+		unsigned char * const flags = flagBuffer.data() + hands.offset;
+
+		// check if it is a cache-hit (in-cache)
+		const CacheHandInteger found = find(set,hash,key);
+		if(found != emptyIndex)
+		{
+			flags[found] |= chanceBit;
+			if(opType == 1)
+			{
+				slots[found].value=*value;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+				{
+					flags[found] &= ~editedBit;
+					saveData(key,*value);
+				}
+				else
+					flags[found] |= editedBit;
+			}
+			return slots[found].value;
+		}
+
+		// write-around: set keeps its items
+		if(opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND)
+		{
+			saveData(key,*value);
+			return *value;
+		}
+
+		// could not found key in cache, so searching in circular-buffer starts
+		if(rebalancing)
+		{
+			countMiss(set,hash);
+		}
+		const CacheHandInteger ctrFound = evictSlot(set,saveData);
+		Slot & victim = slots[ctrFound];
+
+		// "get"
+		if(opType == 0)
+		{
+			victim.value = loadData(key);
+			flags[ctrFound] = validBit;
+		}
+		else // "set"
+		{
+			victim.value = *value;
+			flags[ctrFound] = validBit | ((writePolicy == CacheWritePolicy::WRITE_THROUGH) ? 0 : editedBit);
+			if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+				saveData(key,*value);
+		}
+		victim.key = key;
+		insertIndex(set,hash,ctrFound);
+		return victim.value;
+	}
+
+	// selects a slot with CLOCK second-chance and empties it (edited item is written to backing-store)
+	// slots emptied by extractSlot are used first (otherwise clock hands would evict valid items before reaching them)
+	template<typename Save>
+	CacheHandInteger evictSlot(const size_t set, const Save & saveData)
+	{
+		SetHeader & hands = header[set];
+		Slot * const slots = slotBuffer.data() + hands.offset;
+		unsigned char * const flags = flagBuffer.data() + hands.offset;
+
+		while(hands.numFree>0)
+		{
+			// a free slot may have been filled by clock hands after it was freed
+			const CacheHandInteger freeSlot = freeBuffer[hands.offset + --hands.numFree];
+			if((flags[freeSlot] & validBit) == 0)
+				return freeSlot;
+		}
+
+		CacheHandInteger ctrFound = emptyIndex;
+		while(ctrFound == emptyIndex)
+		{
+			// second-chance hand lowers the "chance" status down if its 1 but slot is saved from eviction
+			flags[hands.ctr] &= ~chanceBit;
+
+			// circular buffer has no bounds
+			hands.ctr++;
+			if(hands.ctr>=hands.capacity)
+			{
+				hands.ctr=0;
+			}
+
+			// unlucky slot is selected for eviction by eviction hand
+			if((flags[hands.ctrEvict] & chanceBit) == 0)
+			{
+				ctrFound=hands.ctrEvict;
+			}
+
+			// circular buffer has no bounds
+			hands.ctrEvict++;
+			if(hands.ctrEvict>=hands.capacity)
+			{
+				hands.ctrEvict=0;
+			}
+		}
+
+		// eviction algorithm start
+		Slot & victim = slots[ctrFound];
+		if(flags[ctrFound] & validBit)
+		{
+			if(flags[ctrFound] & editedBit)
+			{
+				saveData(victim.key,victim.value);
+			}
+			const size_t victimHash = hasher(victim.key);
+			eraseIndex(set,victimHash,ctrFound);
+			flags[ctrFound] = 0;
+			if(rebalancing)
+			{
+				ghostBuffer[set*ghostSize + ghostOf(victimHash)] = fingerprintOf(victimHash);
+			}
+		}
+		return ctrFound;
+	}
+
+	// removes key from set if it is in cache (slot becomes empty), returns false if key is not in cache
+	bool extractSlot(const size_t set, const size_t hash, const CacheKey & key, CacheValue & value, bool & dirty)
+	{
+		const CacheHandInteger found = find(set,hash,key);
+		if(found == emptyIndex)
+		{
+			if(rebalancing)
+			{
+				countMiss(set,hash);
+			}
+			return false;
+		}
+
+		Slot & item = slotBuffer[header[set].offset + found];
+		unsigned char & flag = flagBuffer[header[set].offset + found];
+		value = std::move(item.value);
+		dirty = (flag & editedBit) != 0;
+		eraseIndex(set,hash,found);
+		flag = 0;
+		SetHeader & hands = header[set];
+		if(hands.numFree < hands.capacity)
+			freeBuffer[hands.offset + hands.numFree++] = found;
+		return true;
+	}
+
+	// puts key into set without reading backing-store, existing item is overwritten (and stays edited if it was)
+	void insertSlot(const size_t set, const size_t hash, const CacheKey & key, const CacheValue & value, const bool dirty)
+	{
+		const CacheHandInteger found = find(set,hash,key);
+		if(found != emptyIndex)
+		{
+			slotBuffer[header[set].offset + found].value = value;
+			flagBuffer[header[set].offset + found] |= (dirty ? editedBit : 0) | chanceBit;
+			return;
+		}
+
+		const CacheHandInteger ctrFound = evictSlot(set,saveData);
+		Slot & victim = slotBuffer[header[set].offset + ctrFound];
+		victim.value = value;
+		victim.key = key;
+		flagBuffer[header[set].offset + ctrFound] = validBit | (dirty ? editedBit : 0);
+		insertIndex(set,hash,ctrFound);
+	}
+
+	// writes edited slots of a set to backing-store, slots stay in cache as clean
+	// each edited slot is written under its own lock-hold (writes of a key to backing-store stay ordered with its evictions)
+	// rebalance/resize between 2 holds moves slots, then scan of set starts again
+	void flushSet(const size_t set)
+	{
+		size_t i = 0;
+		size_t layout = 0;
+		bool first = true;
+		while(true)
+		{
+			ProfiledLockGuard<std::mutex> lg(header[set].mut,profiler,set);
+			if(first || layout != layoutVersion)
+			{
+				i = 0;
+				layout = layoutVersion;
+				first = false;
+			}
+			Slot * const slots = slotBuffer.data() + header[set].offset;
+			unsigned char * const flags = flagBuffer.data() + header[set].offset;
+			while(i<header[set].capacity && (flags[i] & (validBit|editedBit)) != (validBit|editedBit))
+				i++;
+			if(i>=header[set].capacity)
+				return;
+			flags[i] &= ~editedBit;
+			saveData(slots[i].key,slots[i].value);
+			i++;
+		}
+	}
+
+	// miss of a recently evicted key is a ghost-hit (set would hit with more tags)
+	inline
+	void countMiss(const size_t set, const size_t hash) noexcept
+	{
+		uint32_t & ghost = ghostBuffer[set*ghostSize + ghostOf(hash)];
+		if(ghost == fingerprintOf(hash))
+		{
+			header[set].ghostHits++;
+			ghost = 0;
+		}
+		if(rebalanceInterval>0 && (missCounter.fetch_add(1,std::memory_order_relaxed)+1) % rebalanceInterval == 0)
+		{
+			rebalanceRequested.store(true,std::memory_order_relaxed);
+		}
+	}
+
+	// automatic rebalance is started after the lock of accessed set is released (rebalance locks all sets)
+	inline
+	void rebalanceIfRequested() noexcept
+	{
+		if(rebalanceRequested.load(std::memory_order_relaxed) && rebalanceRequested.exchange(false))
+		{
+			rebalance();
+		}
+	}
+
+	// all sets are locked
+	void rebalanceLocked()
+	{
+		// receivers: most ghost-hits first, donors: fewest ghost-hits first
+		std::vector<size_t> order(numSet);
+		std::iota(order.begin(),order.end(),0);
+		std::stable_sort(order.begin(),order.end(),[&](const size_t a, const size_t b){ return header[a].ghostHits > header[b].ghostHits; });
+
+		std::vector<size_t> newCapacity(numSet);
+		for(size_t i=0;i<numSet;i++)
+			newCapacity[i]=header[i].capacity;
+
+		const size_t quantum = std::max(numTag/8,(size_t)1);
+		const size_t maxPairs = std::max(numSet/4,(size_t)1);
+		size_t numPairs = 0;
+		size_t top = 0;
+		size_t bottom = numSet-1;
+		while(top<bottom && numPairs<maxPairs)
+		{
+			const size_t receiver = order[top];
+			const size_t donor = order[bottom];
+
+			// moving tags only pays off when receiver loses clearly more hits than donor would
+			if(header[receiver].ghostHits < 2 || header[receiver].ghostHits <= 2*header[donor].ghostHits)
+				break;
+			if(newCapacity[receiver]+quantum > maxTags)
+			{
+				top++;
+				continue;
+			}
+			if(newCapacity[donor] < minTags+quantum)
+			{
+				bottom--;
+				continue;
+			}
+			newCapacity[receiver] += quantum;
+			newCapacity[donor] -= quantum;
+			numPairs++;
+			top++;
+			bottom--;
+		}
+
+		for(size_t i=0;i<numSet;i++)
+			header[i].ghostHits >>= 1;
+
+		if(numPairs>0)
+			relayout(newCapacity);
+	}
+
+	// moves sets to new ranges with new capacities, a shrinking set keeps its items with second-chance first
+	void relayout(const std::vector<size_t> & newCapacity)
+	{
+		const size_t totalCapacity = std::accumulate(newCapacity.begin(),newCapacity.end(),(size_t)0);
+		std::vector<Slot> newSlotBuffer(totalCapacity,Slot{CacheKey(),CacheValue()});
+		std::vector<unsigned char> newFlagBuffer(totalCapacity,0);
+		std::fill(indexBuffer.begin(),indexBuffer.end(),emptyIndex);
+		if(freeBuffer.size() < totalCapacity)
+			freeBuffer.resize(totalCapacity);
+
+		size_t newOffset = 0;
+		std::vector<size_t> live;
+		for(size_t set=0;set<numSet;set++)
+		{
+			SetHeader & hands = header[set];
+			Slot * const slots = slotBuffer.data() + hands.offset;
+			unsigned char * const flags = flagBuffer.data() + hands.offset;
+
+			live.clear();
+			for(size_t i=0;i<hands.capacity;i++)
+				if(flags[i] & validBit)
+					live.push_back(i);
+			std::stable_partition(live.begin(),live.end(),[&](const size_t i){ return (flags[i] & chanceBit) != 0; });
+
+			hands.offset = newOffset;
+			hands.capacity = (CacheHandInteger)newCapacity[set];
+			hands.ctr = 0;
+			hands.ctrEvict = (CacheHandInteger)(newCapacity[set]/2);
+			hands.numFree = 0;
+
+			for(size_t i=0;i<live.size();i++)
+			{
+				Slot & item = slots[live[i]];
+				const size_t hash = hasher(item.key);
+				if(i<newCapacity[set])
+				{
+					newSlotBuffer[newOffset+i] = std::move(item);
+					newFlagBuffer[newOffset+i] = flags[live[i]];
+					insertIndex(set,hash,(CacheHandInteger)i);
+				}
+				else
+				{
+					if(flags[live[i]] & editedBit)
+					{
+						saveData(item.key,item.value);
+					}
+					if(rebalancing)
+					{
+						ghostBuffer[set*ghostSize + ghostOf(hash)] = fingerprintOf(hash);
+					}
+				}
+			}
+			for(size_t i=live.size();i<newCapacity[set];i++)
+				freeBuffer[newOffset + hands.numFree++] = (CacheHandInteger)i;
+			newOffset += newCapacity[set];
+		}
+		slotBuffer.swap(newSlotBuffer);
+		flagBuffer.swap(newFlagBuffer);
+		layoutVersion++;
+	}
+
+	const size_t numSet;
+	const size_t numSetM1;
+	const size_t numTag;
+	size_t minTags;
+	size_t maxTags;
+	size_t rebalanceInterval;
+	bool rebalancing;
+	std::atomic<size_t> missCounter;
+	std::atomic<bool> rebalanceRequested;
+	std::mutex rebalanceMut;
+	size_t layoutVersion;
+	size_t ghostSize;
+	std::vector<uint32_t> ghostBuffer;
+	size_t indexSize;
+	size_t indexSizeM1;
+	size_t setShift;
+	CacheHandInteger emptyIndex;
+	std::unique_ptr<SetHeader[]> header;
+	LockProfiler profiler;
+	std::vector<Slot> slotBuffer;
+	std::vector<unsigned char> flagBuffer;
+	std::vector<CacheHandInteger> freeBuffer;
+	std::vector<CacheHandInteger> indexBuffer;
+	const std::function<CacheValue(CacheKey)> loadData;
+	const std::function<void(CacheKey,CacheValue)> saveData;
+	CacheWritePolicy writePolicy;
+	CacheKeyHasher hasher;
 };
 
 
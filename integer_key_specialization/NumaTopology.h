@@ -0,0 +1,164 @@
+/*
+ * NumaTopology.h
+ *
+ *  Created on: Nov 16, 2021
+ *      Author: tugrul
+ */
+
+#ifndef NUMATOPOLOGY_H_
+#define NUMATOPOLOGY_H_
+
+#include<vector>
+#include<string>
+#include<fstream>
+#include<thread>
+#include<algorithm>
+#include<stdexcept>
+#if defined(__linux__)
+#include<sched.h>
+#endif
+
+/* NUMA nodes and their CPUs, read from /sys/devices/system/node (Linux, no libnuma needed)
+ * other systems (or missing sysfs) are seen as 1 node with all CPUs
+ * currentNode(): node of CPU that runs calling thread (sched_getcpu, re-checked every 256 calls because scheduler can move threads)
+ * runOnNode(): runs a function on a thread bound to CPUs of a node, memory allocated and initialized in it is placed on that node (first-touch)
+ */
+class NumaTopology
+{
+public:
+	// numNodes: 0 = detected nodes
+	// 			 otherwise CPU i is assigned to node (i % numNodes), to test NUMA-aware code on a single-node system
+	NumaTopology(const int numNodes = 0)
+	{
+		const int numCpus = std::max((int)std::thread::hardware_concurrency(),1);
+		cpuNode = std::vector<int>(numCpus,0);
+		if(numNodes <= 0)
+			detect(numCpus);
+		if(nodeCpus.size() == 0 || numNodes > 0)
+		{
+			const int nodes = std::max(numNodes,1);
+			nodeCpus = std::vector<std::vector<int>>(nodes);
+			for(int cpu=0;cpu<numCpus;cpu++)
+			{
+				cpuNode[cpu] = cpu % nodes;
+				nodeCpus[cpu % nodes].push_back(cpu);
+			}
+		}
+	}
+
+	// number of nodes
+	inline
+	int size() const noexcept
+	{
+		return (int)nodeCpus.size();
+	}
+
+	inline
+	int nodeOfCpu(const int cpu) const noexcept
+	{
+		return (cpu>=0 && cpu<(int)cpuNode.size()) ? cpuNode[cpu] : 0;
+	}
+
+	const std::vector<int> & cpusOfNode(const int node) const noexcept
+	{
+		return nodeCpus[node];
+	}
+
+	// node of calling thread
+	inline
+	int currentNode() const noexcept
+	{
+		if(nodeCpus.size() == 1)
+			return 0;
+#if defined(__linux__)
+		static thread_local int cpu = 0;
+		static thread_local unsigned int calls = 0;
+		if((calls++ & 255) == 0)
+			cpu = sched_getcpu();
+		return nodeOfCpu(cpu);
+#else
+		return 0;
+#endif
+	}
+
+	// runs func() on a new thread that is bound to CPUs of node, returns after func returns
+	template<typename Func>
+	void runOnNode(const int node, const Func & func) const
+	{
+		std::thread worker([&](){
+			bindCurrentThread(node);
+			func();
+		});
+		worker.join();
+	}
+
+	// binds calling thread to CPUs of node (no effect on non-Linux systems)
+	void bindCurrentThread(const int node) const
+	{
+#if defined(__linux__)
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		for(const int cpu:nodeCpus[node])
+			if(cpu < CPU_SETSIZE)
+				CPU_SET(cpu,&cpus);
+		sched_setaffinity(0,sizeof(cpus),&cpus);
+#endif
+	}
+private:
+	void detect(const int numCpus)
+	{
+		const std::vector<int> nodes = parseList(readLine("/sys/devices/system/node/online"));
+		if(nodes.size() == 0)
+			return;
+
+		// node ids can have gaps, they are renumbered as 0,1,2,...
+		for(const int node:nodes)
+		{
+			const std::vector<int> cpus = parseList(readLine("/sys/devices/system/node/node"+std::to_string(node)+"/cpulist"));
+			if(cpus.size() == 0)
+				continue; // memory-only node
+			for(const int cpu:cpus)
+				if(cpu < numCpus)
+					cpuNode[cpu] = (int)nodeCpus.size();
+			nodeCpus.push_back(cpus);
+		}
+	}
+
+	static std::string readLine(const std::string & path)
+	{
+		std::ifstream file(path);
+		std::string line;
+		std::getline(file,line);
+		return line;
+	}
+
+	// "0-3,8,10-11" -> 0,1,2,3,8,10,11
+	static std::vector<int> parseList(const std::string & list)
+	{
+		std::vector<int> result;
+		size_t pos = 0;
+		while(pos < list.size())
+		{
+			size_t end = list.find(',',pos);
+			if(end == std::string::npos)
+				end = list.size();
+			const std::string range = list.substr(pos,end-pos);
+			const size_t dash = range.find('-');
+			try
+			{
+				const int first = std::stoi(range.substr(0,dash));
+				const int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash+1));
+				for(int i=first;i<=last;i++)
+					result.push_back(i);
+			}catch(std::exception &){ }
+			pos = end + 1;
+		}
+		return result;
+	}
+
+	std::vector<int> cpuNode;
+	std::vector<std::vector<int>> nodeCpus;
+};
+
+
+#endif /* NUMATOPOLOGY_H_ */
@@ -0,0 +1,94 @@
+/*
+ * ParallelFor.h
+ *
+ *  Created on: Nov 10, 2021
+ *      Author: tugrul
+ */
+
+#ifndef PARALLELFOR_H_
+#define PARALLELFOR_H_
+
+#include<vector>
+#include<thread>
+#include<atomic>
+#include<mutex>
+#include<exception>
+#include<algorithm>
+
+/* runs func(index, worker) for each index in [0,n) on numThreads threads
+ * indices are given to threads one by one (dynamic scheduling) so uneven work per index is balanced
+ * worker: 0 to (number of threads - 1), to let func use per-thread resources (e.g. a private cache per worker)
+ * numThreads <= 0: std::thread::hardware_concurrency()
+ * calling thread is worker 0 (only numThreads-1 threads are created), returns after all indices are done
+ * first exception thrown by func is re-thrown after all threads are joined (remaining indices are skipped)
+ * threads live only during the call (no pool): starting and joining them costs tens of microseconds per thread,
+ * small next to flushing a cache (its callers) but too much for short loops that are called often
+ */
+template<typename Func>
+void parallelFor(const size_t n, int numThreads, const Func & func)
+{
+	if(numThreads<=0)
+		numThreads = std::max((int)std::thread::hardware_concurrency(),1);
+	if((size_t)numThreads > n)
+		numThreads = (int)n;
+	if(numThreads<=1)
+	{
+		for(size_t i=0;i<n;i++)
+			func(i,0);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr error = nullptr;
+	std::mutex errorMut;
+	auto work = [&](const int worker){
+		try
+		{
+			size_t i;
+			while((i=next.fetch_add(1,std::memory_order_relaxed)) < n)
+				func(i,worker);
+		}
+		catch(...)
+		{
+			std::lock_guard<std::mutex> lg(errorMut);
+			if(!error)
+				error = std::current_exception();
+			next.store(n);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for(int t=1;t<numThreads;t++)
+		threads.emplace_back(work,t);
+	work(0);
+	for(auto & thread:threads)
+		thread.join();
+	if(error)
+		std::rethrow_exception(error);
+}
+
+// runs func(begin, end) for consecutive chunks of [0,n) on numThreads threads
+// n is split into (4 x threads) chunks to balance uneven chunks, numThreads <= 1 runs func(0,n) on calling thread
+template<typename Func>
+void parallelForChunks(const size_t n, int numThreads, const Func & func)
+{
+	if(numThreads<=0)
+		numThreads = std::max((int)std::thread::hardware_concurrency(),1);
+	if(numThreads<=1 || n<2)
+	{
+		func((size_t)0,n);
+		return;
+	}
+
+	const size_t numChunks = std::min(n,(size_t)numThreads*4);
+	const size_t chunkSize = (n + numChunks - 1)/numChunks;
+	parallelFor(numChunks,numThreads,[&](const size_t chunk, const int){
+		const size_t begin = chunk*chunkSize;
+		const size_t end = std::min(begin+chunkSize,n);
+		if(begin<end)
+			func(begin,end);
+	});
+}
+
+
+#endif /* PARALLELFOR_H_ */
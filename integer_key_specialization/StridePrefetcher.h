@@ -0,0 +1,275 @@
+/*
+ * StridePrefetcher.h
+ *
+ *  Created on: Nov 9, 2021
+ *      Author: tugrul
+ */
+
+#ifndef STRIDEPREFETCHER_H_
+#define STRIDEPREFETCHER_H_
+
+#include<vector>
+#include<type_traits>
+#include"CacheKeyND.h"
+
+/* Hardware-style stream prefetcher for integer-key caches (1D keys and N-dimensional keys)
+ * Watches cache-miss keys (and hits on prefetched keys), keeps a small table of streams
+ * 		each stream: last miss key, stride (per dimension), confidence
+ * 		a miss that continues a stream (last + stride) raises its confidence
+ * 		a miss near a stream (within maxDistance per dimension) retrains its stride
+ * 		a confirmed stream (confidence >= 2) asks for next "degree" keys along the stride, before they are requested
+ * 		first access to the first key of a prefetched batch (reported by cache with onPrefetchHit) asks for next batch (run-ahead)
+ * Raster order (2D/3D scans): a miss 1 step away from start point of a confirmed stream
+ * 		(in a dimension that stream does not move along) continues that stream on next row, so next row is prefetched without re-training
+ * Predicted keys outside of [0,keyLimit) are not requested (no reads past the end of an image/array of backing-store)
+ * Not thread-safe, caches guard it with their own lock in thread-safe methods
+ * CacheKey: integer key type
+ * N: number of dimensions of key (1 for DirectMappedCache, 2 for 2D cache, ...)
+ */
+template<typename CacheKey, size_t N=1>
+class StridePrefetcher
+{
+public:
+	using CacheKeyNDType = CacheKeyND<CacheKey,N>;
+
+	// keyLimit: number of keys of backing-store per dimension, only keys in [0,keyLimit) are prefetched
+	// numStreams: number of concurrently tracked streams (e.g. 4 input images of a kernel = 4 streams)
+	// degree: number of keys to prefetch per confirmed miss
+	// maxDistance: largest stride (per dimension) that is detected
+	StridePrefetcher(const CacheKeyNDType & keyLimit, const int numStreams=4, const int degree=4, const CacheKey maxDistance=64):
+		limit(keyLimit),prefetchDegree(degree),distance(maxDistance),time(0),streams(numStreams>0?numStreams:1)
+	{
+
+	}
+
+	// observes a cache-miss key, calls prefetch(key) for each predicted key
+	// returns true if key continues a confirmed stream (a scan), degree=0 uses only this detection without prefetching
+	template<typename PrefetchFunction>
+	bool onMiss(const CacheKeyNDType & key, const PrefetchFunction & prefetch)
+	{
+		time++;
+		Stream * hit = nullptr;
+		Stream * near = nullptr;
+		Stream * victim = &streams[0];
+		for(auto & stream:streams)
+		{
+			if(!stream.valid)
+			{
+				if(victim->valid || stream.lastUse<victim->lastUse)
+					victim = &stream;
+				continue;
+			}
+
+			if(add(stream.last,stream.stride) == key && !isZero(stream.stride))
+			{
+				hit = &stream;
+				break;
+			}
+
+			if(near == nullptr && isNear(stream.last,key))
+				near = &stream;
+
+			if(victim->valid && stream.lastUse<victim->lastUse)
+				victim = &stream;
+		}
+
+		if(hit)
+		{
+			// stream continues
+			if(hit->confidence<255)
+				hit->confidence++;
+			hit->lastUse = time;
+			hit->last = key;
+			if(hit->confidence>=2)
+				issue(*hit,prefetch);
+			return hit->confidence>=2;
+		}
+
+		// raster order: scan continues from next row (1 step away from start of a confirmed stream, in a dimension that stream does not move along)
+		for(auto & stream:streams)
+		{
+			if(stream.valid && stream.confidence>=2 && isNextRow(stream,key))
+			{
+				stream.lastUse = time;
+				stream.last = key;
+				stream.start = key;
+				issue(stream,prefetch);
+				return true;
+			}
+		}
+
+		if(near)
+		{
+			// stride changed (or first repeat)
+			near->stride = sub(key,near->last);
+			near->confidence = 1;
+			near->hasTrigger = false;
+			near->lastUse = time;
+			near->last = key;
+			near->start = key;
+			return false;
+		}
+
+		// new stream
+		victim->valid = true;
+		victim->hasTrigger = false;
+		victim->confidence = 0;
+		victim->stride = CacheKeyNDType(zeroKey());
+		victim->lastUse = time;
+		victim->last = key;
+		victim->start = key;
+		return false;
+	}
+
+	// observes first access to a prefetched key (a cache-hit that would be a miss without prefetching)
+	// if it is the trigger key of a stream (first key of its latest prefetch batch), next batch is requested
+	// so a steady scan stays "degree" keys ahead and does not miss at all after the stream is confirmed
+	template<typename PrefetchFunction>
+	void onPrefetchHit(const CacheKeyNDType & key, const PrefetchFunction & prefetch)
+	{
+		for(auto & stream:streams)
+		{
+			if(stream.valid && stream.hasTrigger && stream.trigger == key)
+			{
+				time++;
+				stream.lastUse = time;
+				issue(stream,prefetch);
+				return;
+			}
+		}
+	}
+
+	// forgets all streams
+	void reset()
+	{
+		for(auto & stream:streams)
+			stream.valid = false;
+	}
+
+private:
+	struct Stream
+	{
+		Stream():last(),start(),stride(),trigger(),confidence(0),lastUse(0),valid(false),hasTrigger(false){ }
+		CacheKeyNDType last;
+		CacheKeyNDType start;
+		CacheKeyNDType stride;
+		CacheKeyNDType trigger;
+		unsigned char confidence;
+		size_t lastUse;
+		bool valid;
+		bool hasTrigger;
+	};
+
+	// requests next "degree" keys after last key of the stream
+	// prefetched keys will be hits, so next miss of this stream is after them
+	template<typename PrefetchFunction>
+	void issue(Stream & stream, const PrefetchFunction & prefetch)
+	{
+		stream.hasTrigger = false;
+		for(int i=0;i<prefetchDegree;i++)
+		{
+			const CacheKeyNDType next = add(stream.last,stream.stride);
+			if(!inRange(next))
+				break;
+			prefetch(next);
+			stream.last = next;
+			if(i==0)
+			{
+				stream.trigger = next;
+				stream.hasTrigger = true;
+			}
+		}
+	}
+
+	static CacheKeyNDType zeroKey()
+	{
+		CacheKeyNDType result;
+		for(size_t i=0;i<N;i++)
+			result.k[i]=0;
+		return result;
+	}
+
+	static bool isZero(const CacheKeyNDType & key)
+	{
+		for(size_t i=0;i<N;i++)
+			if(key.k[i]!=0)
+				return false;
+		return true;
+	}
+
+	static CacheKeyNDType add(const CacheKeyNDType & a, const CacheKeyNDType & b)
+	{
+		CacheKeyNDType result;
+		for(size_t i=0;i<N;i++)
+			result.k[i]=(CacheKey)(a.k[i]+b.k[i]);
+		return result;
+	}
+
+	static CacheKeyNDType sub(const CacheKeyNDType & a, const CacheKeyNDType & b)
+	{
+		CacheKeyNDType result;
+		for(size_t i=0;i<N;i++)
+			result.k[i]=(CacheKey)(a.k[i]-b.k[i]);
+		return result;
+	}
+
+	static bool inRange(const CacheKey & key, const CacheKey & keyLimit)
+	{
+		if constexpr (std::is_signed<CacheKey>::value)
+		{
+			if(key<0)
+				return false;
+		}
+		return key<keyLimit;
+	}
+
+	bool inRange(const CacheKeyNDType & key) const
+	{
+		for(size_t i=0;i<N;i++)
+			if(!inRange(key.k[i],limit.k[i]))
+				return false;
+		return true;
+	}
+
+	// |a-b| <= distance in all dimensions
+	bool isNear(const CacheKeyNDType & a, const CacheKeyNDType & b) const
+	{
+		for(size_t i=0;i<N;i++)
+		{
+			const CacheKey d = (a.k[i]>b.k[i]) ? (CacheKey)(a.k[i]-b.k[i]) : (CacheKey)(b.k[i]-a.k[i]);
+			if(d>distance)
+				return false;
+		}
+		return true;
+	}
+
+	// key = stream.start +/- 1 in exactly one dimension where stream does not move
+	bool isNextRow(const Stream & stream, const CacheKeyNDType & key) const
+	{
+		if(N<2)
+			return false;
+		size_t numDifferent = 0;
+		for(size_t i=0;i<N;i++)
+		{
+			if(key.k[i]==stream.start.k[i])
+				continue;
+			if(stream.stride.k[i]!=0)
+				return false;
+			const CacheKey d = (key.k[i]>stream.start.k[i]) ? (CacheKey)(key.k[i]-stream.start.k[i]) : (CacheKey)(stream.start.k[i]-key.k[i]);
+			if(d!=1)
+				return false;
+			numDifferent++;
+		}
+		return numDifferent==1;
+	}
+
+	const CacheKeyNDType limit;
+	const int prefetchDegree;
+	const CacheKey distance;
+	size_t time;
+	std::vector<Stream> streams;
+};
+
+
+
+#endif /* STRIDEPREFETCHER_H_ */
@@ -0,0 +1,136 @@
+/*
+ * StripedLockTable.h
+ *
+ *  Created on: Nov 11, 2021
+ *      Author: tugrul
+ */
+
+#ifndef STRIPEDLOCKTABLE_H_
+#define STRIPEDLOCKTABLE_H_
+
+#include<vector>
+#include<mutex>
+#include<memory>
+#include"../LockProfiler.h"
+
+/* fixed number of mutexes (stripes) shared by all slots of a cache: slot i is guarded by stripe (i % numStripes)
+ * replaces 1 mutex per slot: a 1M-slot cache uses 4096 x 64 bytes = 256kB of locks instead of 1M x 256 bytes = 256MB
+ * neighbor slots map to different stripes so a sequential/tiled access pattern of multiple threads does not contend more than per-slot locks
+ * each stripe is on its own 64-byte line (no false-sharing between stripes)
+ * numStripes: rounded up to integer power of 2
+ * 		more stripes = less contention between unrelated slots, more memory
+ * 		fewer stripes = smaller table that stays in L1/L2 of CPU, more contention
+ * lock statistics per stripe: enableProfiler() + Guard/lockStripe/unlockStripe (locks taken through of()/stripe() are not recorded)
+ */
+class StripedLockTable
+{
+public:
+	static constexpr size_t defaultMaxStripes = 4096;
+
+	// numSlots: number of slots to guard
+	// numStripes: number of mutexes, 0 = min(numSlots,defaultMaxStripes)
+	StripedLockTable(const size_t numSlots = 0, const size_t numStripes = 0):stripeM1(0),numStripesPow2(0)
+	{
+		if(numSlots == 0 && numStripes == 0)
+			return;
+
+		size_t wanted = (numStripes>0) ? numStripes : (numSlots<defaultMaxStripes ? numSlots : defaultMaxStripes);
+		if(wanted<1)
+			wanted = 1;
+		numStripesPow2 = 1;
+		while(numStripesPow2 < wanted)
+			numStripesPow2 <<= 1;
+		stripeM1 = numStripesPow2 - 1;
+		stripes = std::unique_ptr<Stripe[]>(new Stripe[numStripesPow2]);
+		profiler = std::make_unique<LockProfiler>();
+	}
+
+	// lock_guard of the stripe that guards a slot
+	class Guard
+	{
+	public:
+		Guard(const StripedLockTable & table, const size_t slot):lockTable(table),stripeIndex(slot & table.stripeM1)
+		{
+			lockTable.lockStripe(stripeIndex);
+		}
+
+		~Guard()
+		{
+			lockTable.unlockStripe(stripeIndex);
+		}
+
+		Guard(const Guard &) = delete;
+		Guard & operator=(const Guard &) = delete;
+	private:
+		const StripedLockTable & lockTable;
+		const size_t stripeIndex;
+	};
+
+	// stripe index that guards a slot
+	inline
+	size_t stripeOf(const size_t slot) const noexcept
+	{
+		return slot & stripeM1;
+	}
+
+	// mutex that guards a slot
+	inline
+	std::mutex & of(const size_t slot) const noexcept
+	{
+		return stripes[slot & stripeM1].mut;
+	}
+
+	// mutex of a stripe index
+	inline
+	std::mutex & stripe(const size_t stripeIndex) const noexcept
+	{
+		return stripes[stripeIndex].mut;
+	}
+
+	inline
+	void lockStripe(const size_t stripeIndex) const
+	{
+		profiler->lock(stripes[stripeIndex].mut,stripeIndex);
+	}
+
+	inline
+	void unlockStripe(const size_t stripeIndex) const
+	{
+		profiler->unlock(stripes[stripeIndex].mut,stripeIndex);
+	}
+
+	// starts recording statistics per stripe (only for allocated table)
+	void enableProfiler()
+	{
+		if(profiler)
+			profiler->enable(numStripesPow2);
+	}
+
+	// statistics per stripe index (empty if table is not allocated)
+	const LockProfiler & getProfiler() const
+	{
+		static const LockProfiler unused;
+		return profiler ? *profiler : unused;
+	}
+
+	// number of stripes (0 = not allocated, thread-safe methods are not usable)
+	inline
+	size_t size() const noexcept
+	{
+		return numStripesPow2;
+	}
+
+private:
+	struct alignas(64) Stripe
+	{
+		std::mutex mut;
+	};
+
+	size_t stripeM1;
+	size_t numStripesPow2;
+	std::unique_ptr<Stripe[]> stripes;
+	std::unique_ptr<LockProfiler> profiler;
+};
+
+
+#endif /* STRIPEDLOCKTABLE_H_ */
@@ -0,0 +1,146 @@
+/*
+ * TiledExecutor.h
+ *
+ *  Created on: Nov 10, 2021
+ *      Author: tugrul
+ */
+
+#ifndef TILEDEXECUTOR_H_
+#define TILEDEXECUTOR_H_
+
+#include<vector>
+#include<array>
+#include<memory>
+#include<utility>
+#include"CacheKeyND.h"
+#include"DirectMappedNDCache.h"
+#include"ParallelFor.h"
+
+/* work item of parallelForTiles: one tile of the domain and the private (unlocked) cache of the worker that runs it
+ * begin/end: 	interior of the tile, [begin[i],end[i]) for each dimension i, tiles do not overlap
+ * haloBegin/haloEnd: interior extended by halo width and clipped to the domain
+ * 				every key in halo box maps to a different slot of the private cache, so after first touch all reads in the box are cache-hits
+ * get: 		reads through private cache, misses are served by getThreadSafe of the shared LLC (any key can be read, halo box is only the conflict-free part)
+ * set: 		writes into private cache, written to LLC with setThreadSafe when evicted or when parallelForTiles ends
+ * 				only keys of tile interior should be written (two workers writing same key = undefined order)
+ */
+template<typename CacheKey, typename CacheValue, typename DimensionSequence>
+class TileContextImpl;
+
+template<typename CacheKey, typename CacheValue, size_t ... Dimension>
+class TileContextImpl<CacheKey,CacheValue,std::index_sequence<Dimension...>>
+{
+	static constexpr size_t N = sizeof...(Dimension);
+public:
+	TileContextImpl(DirectMappedNDCache<CacheKey,CacheValue,N> * privateCache, const int workerIndex):worker(workerIndex),tileIndex(0),cache(privateCache)
+	{
+
+	}
+
+	inline
+	const CacheValue get(const RepeatForDimension<CacheKey,Dimension> & ... keys) noexcept
+	{
+		return cache->get(keys...);
+	}
+
+	inline
+	void set(const RepeatForDimension<CacheKey,Dimension> & ... keys, const CacheValue & val) noexcept
+	{
+		cache->set(CacheKeyND<CacheKey,N>(keys...),val);
+	}
+
+	std::array<CacheKey,N> begin;
+	std::array<CacheKey,N> end;
+	std::array<CacheKey,N> haloBegin;
+	std::array<CacheKey,N> haloEnd;
+	const int worker;
+	size_t tileIndex;
+private:
+	DirectMappedNDCache<CacheKey,CacheValue,N> * cache;
+};
+
+// TileContext<int,float,2>: tile of a 2D domain with int coordinates and float elements
+template<typename CacheKey, typename CacheValue, size_t N>
+using TileContext = TileContextImpl<CacheKey,CacheValue,std::make_index_sequence<N>>;
+
+/* parallel-for over tiles of an N-dimensional domain [0,domain[0]) x [0,domain[1]) x ...
+ * each worker thread has its own private DirectMappedNDCache (no locks, no mutex array) of cacheElements slots
+ * 		private cache misses go to the shared LLC with getThreadSafe/setThreadSafe
+ * 		so the hit path of a stencil kernel has zero locking and scales with number of cores
+ * tile size is derived from cache size: tile = cacheElements - 2*halo per dimension, so a tile and its halo fit the private cache without conflicts
+ * 		example: 2D, cacheElements={64,64}, halo={1,1} (3x3 stencil) --> 62x62 tiles
+ * tiles are given to workers dynamically, kernel(tile) is called once per tile
+ * dirty private-cache data is written to LLC before returning (results are visible in LLC after the call)
+ * same LLC can be read and written by kernel only if written keys are not read by other tiles in same call (use 2 buffers for in-place stencils)
+ *
+ * CacheKey, CacheValue, N: key type, value type, number of dimensions (given explicitly: parallelForTiles<int,float,2>(...))
+ * llc: 		shared_ptr to a thread-safe cache with getThreadSafe(keys...) and setThreadSafe(keys...,value) (e.g. DirectMapped2DMultiThreadCache)
+ * domain: 		number of elements per dimension
+ * cacheElements: slots of private cache per dimension (integer power of 2 each)
+ * halo: 		number of extra elements read around a tile per dimension (stencil radius)
+ * kernel: 		[&](TileContext<CacheKey,CacheValue,N> & tile){ for(x=tile.begin[0];x<tile.end[0];x++) ... tile.get(x-1,y) ... tile.set(x,y,v); }
+ * numThreads: 	<=0 means std::thread::hardware_concurrency()
+ */
+template<typename CacheKey, typename CacheValue, size_t N, typename LastLevelCache, typename Kernel>
+void parallelForTiles(const std::shared_ptr<LastLevelCache> & llc,
+		const std::array<CacheKey,N> & domain,
+		const std::array<CacheKey,N> & cacheElements,
+		const std::array<CacheKey,N> & halo,
+		const Kernel & kernel,
+		int numThreads = 0)
+{
+	std::array<CacheKey,N> tileSize;
+	std::array<size_t,N> numTilesPerDimension;
+	size_t numTiles = 1;
+	for(size_t i=0;i<N;i++)
+	{
+		tileSize[i] = (cacheElements[i] > 2*halo[i]) ? (CacheKey)(cacheElements[i] - 2*halo[i]) : (CacheKey)1;
+		numTilesPerDimension[i] = ((size_t)domain[i] + tileSize[i] - 1)/tileSize[i];
+		numTiles *= numTilesPerDimension[i];
+	}
+	if(numTiles==0)
+		return;
+
+	if(numThreads<=0)
+		numThreads = std::max((int)std::thread::hardware_concurrency(),1);
+	if((size_t)numThreads > numTiles)
+		numThreads = (int)numTiles;
+
+	// private caches, unlocked
+	std::vector<std::unique_ptr<DirectMappedNDCache<CacheKey,CacheValue,N>>> privateCache;
+	for(int t=0;t<numThreads;t++)
+	{
+		privateCache.push_back(std::make_unique<DirectMappedNDCache<CacheKey,CacheValue,N>>(cacheElements,
+				[llc](auto ... keys){ return llc->getThreadSafe(keys...); },
+				[llc](auto ... keysAndValue){ llc->setThreadSafe(keysAndValue...); },
+				false));
+	}
+
+	parallelFor(numTiles,numThreads,[&](const size_t tileIndex, const int worker){
+		TileContext<CacheKey,CacheValue,N> tile(privateCache[worker].get(),worker);
+		tile.tileIndex = tileIndex;
+
+		// row-major tile order: last dimension is the fastest changing one
+		size_t remaining = tileIndex;
+		for(size_t i=N;i>0;i--)
+		{
+			const size_t d = i-1;
+			const size_t tileCoordinate = remaining % numTilesPerDimension[d];
+			remaining /= numTilesPerDimension[d];
+
+			tile.begin[d] = (CacheKey)(tileCoordinate * tileSize[d]);
+			tile.end[d] = std::min((CacheKey)(tile.begin[d] + tileSize[d]),domain[d]);
+			tile.haloBegin[d] = (tile.begin[d] > halo[d]) ? (CacheKey)(tile.begin[d] - halo[d]) : (CacheKey)0;
+			tile.haloEnd[d] = std::min((CacheKey)(tile.end[d] + halo[d]),domain[d]);
+		}
+		kernel(tile);
+	});
+
+	// dirty data of all workers to LLC
+	parallelFor(privateCache.size(),numThreads,[&](const size_t i, const int){
+		privateCache[i]->flush();
+	});
+}
+
+
+#endif /* TILEDEXECUTOR_H_ */
@@ -12,6 +12,8 @@
 #include<vector>
 #include<functional>
 #include<mutex>
+#include"StripedLockTable.h"
+#include"../CacheWritePolicy.h"
 
 
 /* 2D Direct-mapped constant-sized (256x256) cache implementation with granular locking (per-tag)
@@ -43,16 +45,18 @@ public:
 	//				takes a CacheKey as key and CacheValue as value
 	// numElementsX: has to be integer-power of 2 (e.g. 2,4,8,16,...)
 	// numElementsY: has to be integer-power of 2 (e.g. 2,4,8,16,...)
-	// prepareForMultithreading: by default (true) it allocates an array of structs each with its own mutex to evade false-sharing during getThreadSafe/setThreadSafe calls
-	//          with a given "false" value, it does not allocate mutex array and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
-	//          true: allocates at least extra 256 bytes per cache tag
+	// prepareForMultithreading: by default (true) it allocates a striped lock table (see StripedLockTable.h) for getThreadSafe/setThreadSafe calls
+	//          with a given "false" value, it does not allocate lock table and getThreadSafe/setThreadSafe methods become undefined behavior under multithreaded-use
+	// numLockStripes: number of mutexes (64 bytes each) shared by all tags, 0 = min(number of tags, 4096)
+	//          more stripes = less lock contention, fewer stripes = less memory
 	UltraMapped2DMultiThreadCache(
 				const std::function<CacheValue(CacheKey,CacheKey)> & readMiss,
 				const std::function<void(CacheKey,CacheKey,CacheValue)> & writeMiss,
-				const bool prepareForMultithreading = true):sizeX(256),sizeY(256),loadData(readMiss),saveData(writeMiss)
+				const bool prepareForMultithreading = true,
+				const size_t numLockStripes = 0):sizeX(256),sizeY(256),loadData(readMiss),saveData(writeMiss),writePolicy(CacheWritePolicy::WRITE_BACK)
 	{
 		if(prepareForMultithreading)
-			mut = std::vector<MutexWithoutFalseSharing>(sizeX*sizeY);
+			mut = StripedLockTable(sizeX*sizeY,numLockStripes);
 		// initialize buffers
 		valueBuffer.reserve(sizeX*sizeY);
 		isEditedBuffer.reserve(sizeX*sizeY);
@@ -124,7 +128,7 @@ public:
 			{
 				for (size_t i=0;i<n;i++)
 				{
-					std::lock_guard<MutexWithoutFalseSharing> lg(mut[i].mut);
+					std::lock_guard<std::mutex> lg(mut.of(i));
 					if (isEditedBuffer[i] == 1)
 					{
 						isEditedBuffer[i]=0;
@@ -150,6 +154,15 @@ public:
 		}catch(std::exception &ex){ std::cout<<ex.what()<<std::endl; }
 	}
 
+	// selects how "set" reaches backing-store (see CacheWritePolicy.h), default is WRITE_BACK
+	// 		WRITE_THROUGH: every set calls writeMiss, slots are never edited (flush has nothing to write)
+	// 		WRITE_AROUND: set of a key that is not cached calls writeMiss without evicting a slot
+	// call before using the cache (not thread-safe)
+	void enableWritePolicy(const CacheWritePolicy policy)
+	{
+		writePolicy = policy;
+	}
+
 	// direct mapped cache element access, locked per item for parallelism
 	// opType=0: get
 	// opType=1: set
@@ -160,7 +173,7 @@ public:
 		unsigned char tagX = keyX;
 		unsigned char tagY = keyY;
 		const int index = tagX*(int)sizeY+tagY;
-		std::lock_guard<MutexWithoutFalseSharing> lg(mut[index].mut); // N parallel locks in-flight = less contention in multi-threading
+		std::lock_guard<std::mutex> lg(mut.of(index)); // N parallel locks in-flight = less contention in multi-threading
 
 		// compare keys
 		const auto oldKey2D = keyBuffer[index];
@@ -172,13 +185,21 @@ public:
 			// "set"
 			if(opType == 1)
 			{
-				isEditedBuffer[index]=1;
+				isEditedBuffer[index]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
 				valueBuffer[index]=*value;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					saveData(keyX,keyY,*value);
 			}
 
 			// cache hit value
 			return valueBuffer[index];
 		}
+		else if(opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND)
+		{
+			// bypass: slot keeps its item
+			saveData(keyX,keyY,*value);
+			return *value;
+		}
 		else // cache-miss
 		{
 			CacheValue oldValue = valueBuffer[index];
@@ -206,6 +227,11 @@ public:
 				{
 					valueBuffer[index]=*value;
 					keyBuffer[index]=newKey2D;
+					if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					{
+						isEditedBuffer[index]=0;
+						saveData(keyX,keyY,*value);
+					}
 					return *value;
 				}
 			}
@@ -214,7 +240,7 @@ public:
 				// "set"
 				if(opType == 1)
 				{
-					isEditedBuffer[index]=1;
+					isEditedBuffer[index]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
 				}
 
 				// "get"
@@ -229,6 +255,8 @@ public:
 				{
 					valueBuffer[index]=*value;
 					keyBuffer[index]=newKey2D;
+					if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+						saveData(keyX,keyY,*value);
 					return *value;
 				}
 			}
@@ -258,13 +286,21 @@ public:
 			// "set"
 			if(opType == 1)
 			{
-				isEditedBuffer[index]=1;
+				isEditedBuffer[index]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
 				valueBuffer[index]=*value;
+				if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					saveData(keyX,keyY,*value);
 			}
 
 			// cache hit value
 			return valueBuffer[index];
 		}
+		else if(opType == 1 && writePolicy == CacheWritePolicy::WRITE_AROUND)
+		{
+			// bypass: slot keeps its item
+			saveData(keyX,keyY,*value);
+			return *value;
+		}
 		else // cache-miss
 		{
 			CacheValue oldValue = valueBuffer[index];
@@ -292,6 +328,11 @@ public:
 				{
 					valueBuffer[index]=*value;
 					keyBuffer[index]=newKey2D;
+					if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+					{
+						isEditedBuffer[index]=0;
+						saveData(keyX,keyY,*value);
+					}
 					return *value;
 				}
 			}
@@ -300,7 +341,7 @@ public:
 				// "set"
 				if(opType == 1)
 				{
-					isEditedBuffer[index]=1;
+					isEditedBuffer[index]=(writePolicy != CacheWritePolicy::WRITE_THROUGH);
 				}
 
 				// "get"
@@ -315,6 +356,8 @@ public:
 				{
 					valueBuffer[index]=*value;
 					keyBuffer[index]=newKey2D;
+					if(writePolicy == CacheWritePolicy::WRITE_THROUGH)
+						saveData(keyX,keyY,*value);
 					return *value;
 				}
 			}
@@ -331,22 +374,17 @@ private:
 		CacheKey2D(CacheKey xPrm, CacheKey yPrm):x(xPrm),y(yPrm) { }
 		CacheKey x,y;
 	};
-	struct MutexWithoutFalseSharing
-	{
-		std::mutex mut;
-		char padding[256-sizeof(std::mutex) <= 0 ? 4:256-sizeof(std::mutex)];
-	};
 	const CacheKey sizeX;
 	const CacheKey sizeY;
 
-	std::vector<MutexWithoutFalseSharing> mut;
+	StripedLockTable mut;
 	std::vector<CacheValue> valueBuffer;
 	std::vector<unsigned char> isEditedBuffer;
 	std::vector<CacheKey2D> keyBuffer;
 
 	const std::function<CacheValue(CacheKey,CacheKey)>  loadData;
 	const std::function<void(CacheKey,CacheKey,CacheValue)>  saveData;
-
+	CacheWritePolicy writePolicy;
 };
 
 
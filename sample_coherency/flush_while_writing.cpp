@@ -0,0 +1,87 @@
+#include "../MultiLevelCache.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <iostream>
+
+// flush() as an online checkpoint: writer threads keep writing while another thread flushes the cache again and again
+// each writer owns a disjoint range of keys and writes increasing values to them, then publishes the value it has written
+// flushing thread reads published values before each flush: backing-store has to have at least those values when flush() returns
+// keys of writers do not fit L1 + L2, so items are evicted and move between levels during flushes
+// after writers end, a final flush() has to leave the last written value of every key in backing-store
+struct Database
+{
+	std::vector<int> data;
+	std::mutex mut;
+	Database():data(1024*64,0){ }
+	int read(const int & key){ std::lock_guard<std::mutex> lg(mut); return data[key]; }
+	void write(const int & key, const int & value){ std::lock_guard<std::mutex> lg(mut); data[key]=value; }
+};
+
+const int writers = 3;
+const int keysPerWriter = 2000;
+const int writesPerKey = 200;
+
+int test(const char * name, const bool exclusive)
+{
+	Database db;
+	MultiLevelCache<int,int> cache(256,64,8,[&](int key){ return db.read(key); },[&](int key, int value){ db.write(key,value); });
+	if(exclusive)
+		cache.enableExclusiveMode();
+
+	std::vector<std::atomic<int>> published(writers*keysPerWriter);
+	for(auto & p:published)
+		p.store(0);
+
+	std::atomic<int> runningWriters(writers);
+	std::vector<std::thread> threads;
+	for(int t=0;t<writers;t++)
+		threads.emplace_back([&,t](){
+			for(int v=1;v<=writesPerKey;v++)
+				for(int i=0;i<keysPerWriter;i++)
+				{
+					const int key = t*keysPerWriter + i;
+					cache.setThreadSafe(key,v);
+					published[key].store(v);
+
+					// reads of other writers' keys move items between levels too
+					cache.getThreadSafe((key*7 + v) % (writers*keysPerWriter));
+				}
+			runningWriters--;
+		});
+
+	int flushes = 0;
+	int checkpointErrors = 0;
+	std::vector<int> checkpoint(published.size());
+	threads.emplace_back([&](){
+		while(runningWriters.load() > 0)
+		{
+			for(size_t key=0;key<published.size();key++)
+				checkpoint[key] = published[key].load();
+			cache.flush();
+			flushes++;
+			for(size_t key=0;key<published.size();key++)
+				if(db.read(key) < checkpoint[key])
+					checkpointErrors++;
+		}
+	});
+	for(auto & t:threads)
+		t.join();
+
+	cache.flush();
+	int finalErrors = 0;
+	for(size_t key=0;key<published.size();key++)
+		if(db.read(key) != writesPerKey)
+			finalErrors++;
+
+	std::cout<<name<<": flushes="<<flushes<<" checkpoint errors="<<checkpointErrors<<" final errors="<<finalErrors<<std::endl;
+	return checkpointErrors + finalErrors;
+}
+
+int main()
+{
+	const int errors = test("inclusive",false) + test("exclusive",true);
+	std::cout<<"total errors: "<<errors<<std::endl;
+	return errors != 0;
+}
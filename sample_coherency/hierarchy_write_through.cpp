@@ -0,0 +1,55 @@
+#include "../CacheHierarchy.h"
+#include "../integer_key_specialization/DirectMappedMultiThreadCache.h"
+#include "../integer_key_specialization/NWaySetAssociativeMultiThreadCache.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <iostream>
+
+// write-through L1 under concurrent evictions: a writer must always read back its own completed write
+// other threads keep reading keys that map to same L1 tag as the written key, so the key is evicted and reloaded from L2 all the time
+// (if L1 was written before L2, a reload between the two writes would keep the old value in L1)
+struct Database
+{
+	std::vector<int> data;
+	std::mutex mut;
+	Database():data(1024*64,0){ }
+	int read(const int & key){ std::lock_guard<std::mutex> lg(mut); return data[key]; }
+	void write(const int & key, const int & value){ std::lock_guard<std::mutex> lg(mut); data[key]=value; }
+};
+
+int main()
+{
+	Database db;
+	const int L1tags = 256;
+	const int key = 5;
+	CacheHierarchy<CacheLevel<DirectMappedMultiThreadCache<int,int>,CacheWritePolicy::WRITE_THROUGH>,NWaySetAssociativeMultiThreadCache<int,int>,Database> cache(db,L1tags,std::make_tuple(64,64));
+
+	std::atomic<bool> done(false);
+	std::vector<std::thread> evictors;
+	for(int t=0;t<3;t++)
+		evictors.emplace_back([&,t](){
+			int i = t;
+			while(!done.load())
+			{
+				cache.getThreadSafe(key);
+				cache.getThreadSafe(key + L1tags*(1 + (i++ % 16)));
+			}
+		});
+
+	int stale = 0;
+	for(int i=1;i<=2000000;i++)
+	{
+		cache.setThreadSafe(key,i);
+		if(cache.getThreadSafe(key) != i)
+			stale++;
+	}
+	done.store(true);
+	for(auto & t:evictors)
+		t.join();
+
+	cache.flush();
+	std::cout<<"stale reads: "<<stale<<" database: "<<db.read(key)<<std::endl;
+	return stale != 0;
+}
@@ -0,0 +1,114 @@
+#include "../MultiLevelCache.h"
+#include "../NumaMultiLevelCache.h"
+#include "../integer_key_specialization/CoherentCacheThreader.h"
+#include "../integer_key_specialization/DirectMappedMultiThreadCache.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <iostream>
+
+// read-write coherence of caches that keep unlocked private copies (per thread or per NUMA node)
+// each writer thread owns a disjoint range of keys and writes increasing values to them, then publishes the value it has written
+// reader threads read the published value first and then the key from cache: a value older than the published one is a stale read
+// (a get that starts after a set has returned has to see that set, even if the reader has a private copy of the key)
+struct Database
+{
+	std::vector<int> data;
+	std::mutex mut;
+	Database():data(1024*64,0){ }
+	int read(const int & key){ std::lock_guard<std::mutex> lg(mut); return data[key]; }
+	void write(const int & key, const int & value){ std::lock_guard<std::mutex> lg(mut); data[key]=value; }
+};
+
+const int writers = 2;
+const int readers = 4;
+const int keysPerWriter = 64;
+const int writesPerKey = 5000;
+
+// threadCache(): called once in each thread, returns an object with get(key) and set(key,value) used only by that thread
+template<typename ThreadCache>
+int countStaleReads(const char * name, const ThreadCache & threadCache)
+{
+	std::vector<std::atomic<int>> published(writers*keysPerWriter);
+	for(auto & p:published)
+		p.store(0);
+
+	std::atomic<int> runningWriters(writers);
+	std::atomic<int> stale(0);
+	std::vector<std::thread> threads;
+	for(int t=0;t<writers;t++)
+		threads.emplace_back([&,t](){
+			auto cache = threadCache();
+			for(int v=1;v<=writesPerKey;v++)
+				for(int i=0;i<keysPerWriter;i++)
+				{
+					const int key = t*keysPerWriter + i;
+					cache.set(key,v);
+					published[key].store(v);
+				}
+			runningWriters--;
+		});
+	for(int t=0;t<readers;t++)
+		threads.emplace_back([&,t](){
+			auto cache = threadCache();
+			int i = t;
+			while(runningWriters.load() > 0)
+			{
+				const int key = (i++) % (writers*keysPerWriter);
+				const int minimum = published[key].load();
+				if(cache.get(key) < minimum)
+					stale++;
+			}
+		});
+	for(auto & t:threads)
+		t.join();
+
+	std::cout<<name<<" stale reads: "<<stale.load()<<std::endl;
+	return stale.load();
+}
+
+int main()
+{
+	Database db;
+	int stale = 0;
+
+	// MultiLevelCache with a private L1 per thread
+	{
+		MultiLevelCache<int,int> cache(1024,64,4,[&](int key){ return db.read(key); },[&](int key, int value){ db.write(key,value); });
+		cache.enablePrivateL1(256);
+		struct Access
+		{
+			MultiLevelCache<int,int> * cache;
+			int get(int key){ return cache->getThreadSafe(key); }
+			void set(int key, int value){ cache->setThreadSafe(key,value); }
+		};
+		stale += countStaleReads("MultiLevelCache (private L1)",[&](){ return Access{&cache}; });
+		cache.flush();
+	}
+
+	// NumaMultiLevelCache with 2 nodes (replicas of keys in L1 of each node)
+	{
+		NumaMultiLevelCache<int,int> cache(1024,64,4,[&](int key){ return db.read(key); },[&](int key, int value){ db.write(key,value); },2);
+		struct Access
+		{
+			NumaMultiLevelCache<int,int> * cache;
+			int get(int key){ return cache->getThreadSafe(key); }
+			void set(int key, int value){ cache->setThreadSafe(key,value); }
+		};
+		stale += countStaleReads("NumaMultiLevelCache",[&](){ return Access{&cache}; });
+		cache.flush();
+	}
+
+	// CoherentCacheThreader per thread, sharing 1 LLC and 1 directory
+	{
+		auto LLC = std::make_shared<DirectMappedMultiThreadCache<int,int>>(1024,[&](int key){ return db.read(key); },[&](int key, int value){ db.write(key,value); });
+		auto directory = std::make_shared<CoherenceDirectory>(1024*64);
+		stale += countStaleReads("CoherentCacheThreader",[&](){ return CoherentCacheThreader<DirectMappedMultiThreadCache,int,int>(LLC,directory,64,128); });
+		LLC->flush();
+	}
+
+	std::cout<<"total stale reads: "<<stale<<" database: "<<db.read(keysPerWriter-1)<<std::endl;
+	return stale != 0;
+}
@@ -0,0 +1,23 @@
+#include "../integer_key_specialization/DirectMappedNDCache.h"
+#include<iostream>
+
+int main()
+{
+	// time-varying volume: x,y,z,time
+	int backingStore[10][10][10][4];
+	DirectMappedNDCache<int,int,4> cache({4,4,4,2},
+			[&](int x, int y, int z, int t){ return backingStore[x][y][z][t]; },
+			[&](int x, int y, int z, int t, int value){  backingStore[x][y][z][t]=value; });
+	for(int i=0;i<10;i++)
+		for(int j=0;j<10;j++)
+			for(int k=0;k<10;k++)
+				for(int t=0;t<4;t++)
+					cache.set({i,j,k,t},i+j+k+t); // time major
+
+	cache.flush();
+	std::cout<<"-------------"<<std::endl;
+
+	for(int i=0;i<10;i++)for(int j=0;j<10;j++)for(int k=0;k<10;k++)for(int t=0;t<4;t++)
+		std::cout<<cache.get(i,j,k,t)<<" "<<backingStore[i][j][k][t]<<std::endl;
+	return 0;
+}
@@ -0,0 +1,34 @@
+#include "../integer_key_specialization/DirectMapped2DMultiThreadCache.h"
+#include "../integer_key_specialization/TiledExecutor.h"
+#include<iostream>
+#include<memory>
+
+int main()
+{
+	// multi-threaded image softening: average of a pixel and its 4 closest neighbors
+	const int size = 1024;
+	std::vector<int> image(size*size);
+	std::vector<int> result(size*size);
+	for(int i=0;i<size*size;i++)
+		image[i]=i%255;
+
+	// shared LLC, only accessed on private cache misses
+	auto input = std::make_shared<DirectMapped2DMultiThreadCache<int,int>>(256,256,
+			[&](int x, int y){ return image[x*size+y]; },
+			[&](int x, int y, int value){  image[x*size+y]=value; });
+
+	// 64x64 private cache per thread, halo of 1 pixel for 5-point stencil --> 62x62 tiles
+	parallelForTiles<int,int,2>(input,{size,size},{64,64},{1,1},[&](TileContext<int,int,2> & tile){
+		for(int i=std::max(tile.begin[0],1);i<std::min(tile.end[0],size-1);i++)
+			for(int j=std::max(tile.begin[1],1);j<std::min(tile.end[1],size-1);j++)
+			{
+				// no locking: tile.get reads from private cache of this thread
+				const int sum = tile.get(i,j)+tile.get(i-1,j)+tile.get(i+1,j)+tile.get(i,j-1)+tile.get(i,j+1);
+				// no locking: tile interiors do not overlap and result is not cached anywhere, so each pixel has exactly one writer
+				result[i*size+j] = sum/5;
+			}
+	});
+
+	std::cout<<result[size+1]<<" "<<result[500*size+500]<<std::endl;
+	return 0;
+}
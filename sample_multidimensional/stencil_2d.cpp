@@ -0,0 +1,32 @@
+#include "../integer_key_specialization/DirectMapped2DMultiThreadCache.h"
+#include<iostream>
+
+int main()
+{
+	// image softening: average of a pixel and its 4 closest neighbors
+	const int size = 1024;
+	std::vector<int> image(size*size);
+	std::vector<int> result(size*size);
+	for(int i=0;i<size*size;i++)
+		image[i]=i%255;
+
+	DirectMapped2DMultiThreadCache<int,int> cache(256,256,
+			[&](int x, int y){ return image[x*size+y]; },
+			[&](int x, int y, int value){  image[x*size+y]=value; });
+
+	// 5-point stencil as coordinate offsets
+	const std::vector<std::array<int,2>> pattern = {{0,0},{-1,0},{1,0},{0,-1},{0,1}};
+	int pixels[5];
+	for(int i=1;i<size-1;i++)
+		for(int j=1;j<size-1;j++)
+		{
+			cache.getStencil(i,j,pattern,pixels); // 1 call per pixel instead of 5
+			result[i*size+j]=(pixels[0]+pixels[1]+pixels[2]+pixels[3]+pixels[4])/5;
+		}
+
+	// 10 pixels along X with 1 call: (500,10), (501,10), ... (509,10)
+	int row[10];
+	cache.getRowSpan(10,500,10,row);
+	std::cout<<row[0]<<" "<<row[9]<<" "<<result[size+1]<<std::endl;
+	return 0;
+}